@@ -237,6 +237,16 @@ class SerializedTest:
         self.result_size = 0
         self.result_code = 0
         self.result = b''
+        self.telemetry = {}
+        self.quality = None
+        self.attempts = 0
+        self.quality_status = QUALITY_STATUSES[0]
+        self.phases = {}
+
+    def noisy(self):
+        """Preempted or throttled while it ran, the numbers may be off."""
+        return (self.telemetry.get("involuntary_switches", 0) > 0
+                or self.telemetry.get("throttles", 0) > 0)
 
     def __repr__(self):
         # Represent bytes as length and first few bytes in hex
@@ -256,9 +266,37 @@ class SerializedTest:
         self.metadata = m
 
 
+# First word of the run files. After every result "TEARUN04" (RUN_FILE_MAGIC)
+# has the telemetry, the quality gate and the phase timings, "TEARUN03" the
+# first two and "TEARUN02" only the telemetry
+RUN_FILE_MAGIC = 0x34304e5552414554
+RUN_FILE_MAGIC_QUALITY = 0x33304e5552414554
+RUN_FILE_MAGIC_TELEMETRY = 0x32304e5552414554
+
+# Same order as EACH_PHASE in orchestrator.c
+PHASES = [
+    "dependencies", "manager_build", "manager_load", "build", "load", "run",
+    "diagnostics", "unload", "backoff",
+]
+
+# Same order as the QUALITY_* statuses in orchestrator.c
+QUALITY_STATUSES = ["ungated", "passed", "failed"]
+
+# Same layout as telemetry_t in orchestrator.c, all u64
+TELEMETRY_FIELDS = [
+    "duration_ns", "interrupts", "softirqs", "voluntary_switches",
+    "involuntary_switches", "throttles", "min_freq_khz", "max_freq_khz",
+    "max_temp_mc", "samples",
+]
+
 def load_run(data):
     reader = BufferReader(data)
     num_tests = reader.read_usize()
+    has_phases = num_tests == RUN_FILE_MAGIC
+    has_quality = has_phases or num_tests == RUN_FILE_MAGIC_QUALITY
+    has_telemetry = has_quality or num_tests == RUN_FILE_MAGIC_TELEMETRY
+    if has_telemetry:
+        num_tests = reader.read_usize()
 
     tests = []
     for _ in range(num_tests):
@@ -275,10 +313,78 @@ def load_run(data):
         t.result_code = result_code
         t.result = result
 
+        if has_telemetry:
+            telemetry = BufferReader(reader.read_bytes(reader.read_usize()))
+            for name in TELEMETRY_FIELDS:
+                if telemetry.offset + 8 > len(telemetry.data):
+                    break
+                t.telemetry[name] = telemetry.read_usize()
+
+        if has_quality:
+            # Mirror of quality_t: double value, u32 attempts, u32 status
+            quality = reader.read_bytes(reader.read_usize())
+            value, attempts, status = struct.unpack_from("<dII", quality)
+            t.attempts = attempts
+            t.quality_status = QUALITY_STATUSES[status]
+            if t.quality_status != "ungated":
+                t.quality = value
+
+        if has_phases:
+            # Mirror of phases_t: the wall times, then the child CPU times
+            phases = BufferReader(reader.read_bytes(reader.read_usize()))
+            wall = [phases.read_usize() for _ in PHASES]
+            child = [phases.read_usize() for _ in PHASES]
+            t.phases = {n: (w, c) for n, w, c in zip(PHASES, wall, child)}
+
         tests.append(t)
 
     return tests
 
+# Same order as EACH_QUIET_SETTING in orchestrator.c
+QUIET_SETTINGS = ["governor", "turbo", "cstates", "irqs", "rcu"]
+
+# Same order as the CALIBRATION_* sources in modules/commands.h
+CALIBRATION_SOURCES = ["none", "fixed", "tsc", "perf", "msr"]
+
+class RunInfo:
+    def __init__(self, budget, tsc_hz, core_hz, tsc_per_core, source,
+                 quiet_settings, seed=0):
+        self.budget = budget
+        self.tsc_hz = tsc_hz
+        self.core_hz = core_hz
+        self.tsc_per_core = tsc_per_core
+        self.source = source
+        self.quiet_settings = quiet_settings
+        self.seed = seed  # 0 for the runs from before the seed
+
+    def quiet(self):
+        return [n for i, n in enumerate(QUIET_SETTINGS)
+                if self.quiet_settings & (1 << i)]
+
+    def core_cycles(self, ticks):
+        return ticks / self.tsc_per_core if self.tsc_per_core else ticks
+
+def parse_root(test: SerializedTest) -> RunInfo:
+    """Mirror of root_result_t: calibration_t then the quiet settings.
+
+    Runs from before the calibration only have the clock speed and maybe
+    the quiet settings."""
+    reader = BufferReader(test.result)
+    if test.result_size < 48:
+        clock = reader.read_usize()
+        quiet = reader.read_usize() if test.result_size >= 16 else 0
+        return RunInfo(clock, clock, clock, 1.0, 0, quiet)
+
+    budget = reader.read_usize()
+    tsc_hz = reader.read_usize()
+    core_hz = reader.read_usize()
+    tsc_per_core = reader.read_usize() / (1 << 16)  # FP_SHIFT
+    source = reader.read_int()
+    seed = reader.read_int() & 0xffffffff  # Was padding, so 0 in older runs
+    quiet = reader.read_usize()
+    return RunInfo(budget, tsc_hz, core_hz, tsc_per_core, source, quiet,
+                   seed)
+
 def pretty_print_test(test, name=None):
     if isinstance(test, TestResults):
         s = test.outcome
@@ -286,6 +392,18 @@ def pretty_print_test(test, name=None):
         print(f"  Module: {s.module_name}")
         print(f"  Status: {status}")
         print(f"  Size:   {s.result_size} bytes")
+        if s.telemetry:
+            noise = " (noisy)" if s.noisy() else ""
+            print(f"  Telemetry{noise}: " +
+                  ", ".join(f"{k}={v}" for k, v in s.telemetry.items()))
+        if s.attempts:
+            value = "" if s.quality is None else f" {s.quality:.4g}"
+            print(f"  Quality: {s.quality_status}{value} "
+                  f"after {s.attempts} attempt(s)")
+        if s.phases:
+            print(f"  Phases (ms): " +
+                  ", ".join(f"{k}={w / 1e6:.1f}" for k, (w, _)
+                            in s.phases.items() if w))
         print(f"  Fields:")
         for fname, fmeta in test._fields.items():
             ctype = fmeta["ctype"]
@@ -601,9 +719,18 @@ def load_tests(run_file):
         run = f.read()
         tests = load_run(run)
 
+    global run_info
+
     parsed_tests = {}
     for test in tests:
-        if test.module_name == "root": continue
+        if test.module_name == "root":
+            run_info = parse_root(test)
+            continue
+        if test.noisy():
+            print(f"[WARN] {test.module_name} was measured on a noisy machine")
+        if test.quality_status == "failed":
+            print(f"[WARN] {test.module_name} failed its quality gate "
+                  f"({test.quality:.4g} after {test.attempts} attempts)")
         try:
             parsed_tests[test.module_name] = parse_test(test)
         except Exception as e:
@@ -613,6 +740,7 @@ def load_tests(run_file):
 
 
 tests: dict[str, TestResults] = {}
+run_info: RunInfo = None
 def get_test(t: str) -> TestResults:
     return tests.get(t)
 
@@ -877,6 +1005,16 @@ def process_run(run_file, plot=None, pp=None, export=False):
         exit(0)
 
     if pp:
+        if run_info is not None:
+            quiet = ", ".join(run_info.quiet()) or "no"
+            source = CALIBRATION_SOURCES[run_info.source] \
+                if run_info.source < len(CALIBRATION_SOURCES) else "?"
+            print(f"  Calibration: tsc {run_info.tsc_hz} Hz, "
+                  f"core {run_info.core_hz} Hz "
+                  f"({run_info.tsc_per_core:.3f} ticks/cycle, {source})")
+            print(f"  Quiet machine: {quiet}")
+            if run_info.seed:
+                print(f"  Seed: {run_info.seed}")
         if isinstance(pp, str):
             if pp in tests:
                 pretty_print_test(tests[pp])
@@ -12,6 +12,7 @@ static inline void cache_line_flush(volatile void *);
 static inline void memory_barrier(void);
 static inline void read_memory_barrier(void);
 static inline void write_memory_barrier(void);
+static inline u32 sample_cpu(void);
 
 #define add5(x) apply5(add, x)
 #define add25(x) apply25(add, x)
@@ -45,6 +46,13 @@ static inline u64 get_cycle(void) {
   return __builtin_ia32_rdtsc();
 }
 
+// Linux keeps the CPU number in the low 12 bits of TSC_AUX
+static inline u32 sample_cpu(void) {
+  u32 cpu;
+  __builtin_ia32_rdtscp(&cpu);
+  return cpu & 0xfff;
+}
+
 static inline void load(volatile void *addr) {
   __asm__ __volatile__("mov (%0), %%rax" : : "r"(addr) : "rax", "memory");
 }
@@ -126,6 +134,17 @@ static inline u64 get_cycle(void) {
   return v;
 }
 
+// Harts only migrate threads in the simulation, where mhartid is readable
+static inline u32 sample_cpu(void) {
+#ifdef RUNNER_SIMULATION
+  usize id;
+  __asm__ __volatile__("csrr %0, mhartid" : "=r"(id));
+  return id;
+#else
+  return 0;
+#endif
+}
+
 static inline u64 get_cycle_ser(void) {
   u64 v;
   read_memory_barrier();
@@ -160,4 +179,56 @@ static inline void write_memory_barrier(void) {
 
 #endif
 
+// Sample rejection for the timed loops. A sample is contaminated when the
+// thread changed CPU while it was taken or when it is so long that only an
+// interrupt or an SMI explains it. The timing itself is left to the loop:
+//
+//   sample_t smp = {0};
+//   do {
+//     sample_begin(&smp);
+//     u64 start = get_cycle();
+//     ...
+//     delta = get_cycle() - start;
+//   } while (sample_rejected(&smp, delta, &RESULT->rejected_samples));
+//
+// A loop whose clean samples can be longer than SAMPLE_MAX_CYCLES, fences
+// that trap under virtualization for instance, sets its own bound in
+// max_cycles.
+
+#ifndef SAMPLE_MAX_CYCLES
+#define SAMPLE_MAX_CYCLES 10000
+#endif
+
+// After this many rejections in a row the sample is kept, a loop that is
+// always slow must not spin forever
+#ifndef SAMPLE_MAX_RETRIES
+#define SAMPLE_MAX_RETRIES 16
+#endif
+
+typedef struct {
+  u32 cpu;
+  u32 retries;
+  u64 max_cycles; // 0 for SAMPLE_MAX_CYCLES
+} sample_t;
+
+static inline void sample_begin(sample_t *s) { s->cpu = sample_cpu(); }
+
+static inline bool sample_contaminated(const sample_t *s, u64 delta) {
+  const u64 max = s->max_cycles ? s->max_cycles : SAMPLE_MAX_CYCLES;
+  return delta > max || sample_cpu() != s->cpu;
+}
+
+// True when the sample has to be taken again, it is then counted in
+// `rejected`
+static inline bool sample_rejected(sample_t *s, u64 delta, u64 *rejected) {
+  if (!sample_contaminated(s, delta) || s->retries == SAMPLE_MAX_RETRIES) {
+    s->retries = 0;
+    return false;
+  }
+
+  s->retries++;
+  (*rejected)++;
+  return true;
+}
+
 #endif // _ASM_IMMINTR
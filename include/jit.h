@@ -0,0 +1,346 @@
+#ifndef _JIT
+#define _JIT
+
+#include "types.h"
+
+// Tiny runtime emitter for instruction sleds. Instead of generating headers
+// full of repeated instructions from the manager, tests build the measured
+// function at runtime and can sweep the sled length freely.
+//
+// The emitted function has the signature of jit_func_t: the two arguments are
+// the pointers used by jit_emit_load() and the return value is the cycle delta
+// between jit_emit_cycle_start() and jit_emit_cycle_end().
+
+#define JIT_DEFAULT_CAP (64 * 1024)
+
+typedef struct {
+  u8 *code;
+  usize capacity;
+  usize len;
+  bool overflow;
+} jit_t;
+
+typedef u64 (*jit_func_t)(volatile void *, volatile void *);
+
+bool jit_init(jit_t *j, usize capacity);
+void jit_reset(jit_t *j);
+jit_func_t jit_finalize(jit_t *j);
+void jit_free(jit_t *j);
+
+void jit_emit_nops(jit_t *j, usize n);
+void jit_emit_xors(jit_t *j, usize n, u32 seed);
+void jit_emit_adds(jit_t *j, usize n);
+void jit_emit_load(jit_t *j, usize arg);
+void jit_emit_serialise(jit_t *j);
+void jit_emit_memory_barrier(jit_t *j);
+void jit_emit_cycle_start(jit_t *j);
+void jit_emit_cycle_end(jit_t *j);
+
+#ifdef RUNNER_KERNEL
+
+// A module can't get executable memory, so its tests compile their sleds in.
+// JIT_EACH_512(X) expands X(a, b, c) for every length a * 64 + b * 8 + c
+// below 512 and JIT_REPT() repeats an instruction that many times.
+
+#define JIT_REPT(count, insn) ".rept " count "\n" insn "\n.endr\n"
+#define JIT_LEN_STR(a, b, c) #a "*64+" #b "*8+" #c
+
+#define JIT_EACH_8(X, a, b)                                                    \
+  X(a, b, 0) X(a, b, 1) X(a, b, 2) X(a, b, 3)                                  \
+      X(a, b, 4) X(a, b, 5) X(a, b, 6) X(a, b, 7)
+#define JIT_EACH_64(X, a)                                                      \
+  JIT_EACH_8(X, a, 0) JIT_EACH_8(X, a, 1) JIT_EACH_8(X, a, 2)                  \
+      JIT_EACH_8(X, a, 3) JIT_EACH_8(X, a, 4) JIT_EACH_8(X, a, 5)              \
+          JIT_EACH_8(X, a, 6) JIT_EACH_8(X, a, 7)
+#define JIT_EACH_512(X)                                                        \
+  JIT_EACH_64(X, 0) JIT_EACH_64(X, 1) JIT_EACH_64(X, 2) JIT_EACH_64(X, 3)      \
+      JIT_EACH_64(X, 4) JIT_EACH_64(X, 5) JIT_EACH_64(X, 6)                    \
+          JIT_EACH_64(X, 7)
+
+// Same accumulators as jit_emit_xors()
+#ifdef TARGET_X86_64
+#define JIT_XOR_INSN "xor $0x5a5a5a5a, %%r11"
+#define JIT_XOR_CLOBBER "r11"
+#elif TARGET_RISCV
+#define JIT_XOR_INSN "xori t1, t1, 0x5a5"
+#define JIT_XOR_CLOBBER "t1"
+#endif
+
+#endif
+
+#endif // _JIT
+
+#if defined(_JIT_IMPLEMENTATION) && !defined(_JIT_IMPLEMENTED)
+#define _JIT_IMPLEMENTED
+
+#include "immintr.h"
+
+static void jit_emit_bytes(jit_t *j, const u8 *bytes, usize n) {
+  if (j->len + n > j->capacity) {
+    j->overflow = true;
+    return;
+  }
+
+  for (usize i = 0; i < n; i++)
+    j->code[j->len++] = bytes[i];
+}
+
+static void jit_emit_u32(jit_t *j, u32 v) {
+  const u8 bytes[4] = {v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff,
+                       (v >> 24) & 0xff};
+  jit_emit_bytes(j, bytes, 4);
+}
+
+#ifdef TARGET_X86_64
+
+// Register usage of the emitted code (SysV):
+//   rdi, rsi  pointers passed to the function
+//   r8        start cycle
+//   r11       xor sled accumulator
+//   eax       add sled accumulator
+// rbx is callee saved and is only touched around cpuid.
+
+#define JIT_EMIT(j, ...)                                                       \
+  jit_emit_bytes(j, (const u8[]){__VA_ARGS__},                                 \
+                 sizeof((const u8[]){__VA_ARGS__}))
+
+void jit_emit_nops(jit_t *j, usize n) {
+  for (usize i = 0; i < n; i++)
+    JIT_EMIT(j, 0x90);
+}
+
+void jit_emit_xors(jit_t *j, usize n, u32 seed) {
+  u32 x = seed ? seed : 0x9e3779b9;
+  for (usize i = 0; i < n; i++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    // xor $imm32, %r11
+    JIT_EMIT(j, 0x49, 0x81, 0xf3);
+    jit_emit_u32(j, x);
+  }
+}
+
+void jit_emit_adds(jit_t *j, usize n) {
+  // add $1, %eax
+  for (usize i = 0; i < n; i++)
+    JIT_EMIT(j, 0x83, 0xc0, 0x01);
+}
+
+void jit_emit_load(jit_t *j, usize arg) {
+  if (arg == 0) {
+    JIT_EMIT(j, 0x48, 0x8b, 0x07); // mov (%rdi), %rax
+  } else {
+    JIT_EMIT(j, 0x48, 0x8b, 0x06); // mov (%rsi), %rax
+  }
+}
+
+void jit_emit_serialise(jit_t *j) {
+  // push %rbx; xor %eax, %eax; cpuid; pop %rbx
+  JIT_EMIT(j, 0x53, 0x31, 0xc0, 0x0f, 0xa2, 0x5b);
+}
+
+void jit_emit_memory_barrier(jit_t *j) { JIT_EMIT(j, 0x0f, 0xae, 0xf0); }
+
+void jit_emit_cycle_start(jit_t *j) {
+  // rdtsc; shl $32, %rdx; or %rdx, %rax; mov %rax, %r8
+  JIT_EMIT(j, 0x0f, 0x31, 0x48, 0xc1, 0xe2, 0x20, 0x48, 0x09, 0xd0, 0x49,
+           0x89, 0xc0);
+}
+
+void jit_emit_cycle_end(jit_t *j) {
+  // rdtsc; shl $32, %rdx; or %rdx, %rax; sub %r8, %rax
+  JIT_EMIT(j, 0x0f, 0x31, 0x48, 0xc1, 0xe2, 0x20, 0x48, 0x09, 0xd0, 0x4c,
+           0x29, 0xc0);
+}
+
+static void jit_emit_ret(jit_t *j) { JIT_EMIT(j, __asm_ret); }
+
+#elif TARGET_RISCV
+
+// Register usage of the emitted code:
+//   a0, a1    pointers passed to the function, a0 is also the return value
+//   t2        start cycle
+//   t0        end cycle
+//   t1        xor/add sled accumulator
+
+#define JIT_REG_T0 5
+#define JIT_REG_T1 6
+#define JIT_REG_T2 7
+#define JIT_REG_A0 10
+
+#define JIT_I_TYPE(imm, rs1, funct3, rd, opcode)                               \
+  ((((u32)(imm) & 0xfff) << 20) | ((rs1) << 15) | ((funct3) << 12) |           \
+   ((rd) << 7) | (opcode))
+
+void jit_emit_nops(jit_t *j, usize n) {
+  for (usize i = 0; i < n; i++)
+    jit_emit_u32(j, JIT_I_TYPE(0, 0, 0, 0, 0x13));
+}
+
+void jit_emit_xors(jit_t *j, usize n, u32 seed) {
+  u32 x = seed ? seed : 0x9e3779b9;
+  for (usize i = 0; i < n; i++) {
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+
+    // xori t1, t1, imm12
+    jit_emit_u32(j, JIT_I_TYPE(x, JIT_REG_T1, 4, JIT_REG_T1, 0x13));
+  }
+}
+
+void jit_emit_adds(jit_t *j, usize n) {
+  // addi t1, t1, 1
+  for (usize i = 0; i < n; i++)
+    jit_emit_u32(j, JIT_I_TYPE(1, JIT_REG_T1, 0, JIT_REG_T1, 0x13));
+}
+
+void jit_emit_load(jit_t *j, usize arg) {
+  // ld x0, 0(a0 + arg)
+  jit_emit_u32(j, JIT_I_TYPE(0, JIT_REG_A0 + (arg ? 1 : 0), 3, 0, 0x03));
+}
+
+void jit_emit_serialise(jit_t *j) {
+  jit_emit_u32(j, 0x0ff0000f); // fence iorw, iorw
+  jit_emit_u32(j, 0x0000100f); // fence.i
+}
+
+void jit_emit_memory_barrier(jit_t *j) { jit_emit_u32(j, 0x0ff0000f); }
+
+void jit_emit_cycle_start(jit_t *j) {
+  // rdcycle t2
+  jit_emit_u32(j, JIT_I_TYPE(0xc00, 0, 2, JIT_REG_T2, 0x73));
+}
+
+void jit_emit_cycle_end(jit_t *j) {
+  // rdcycle t0; sub a0, t0, t2
+  jit_emit_u32(j, JIT_I_TYPE(0xc00, 0, 2, JIT_REG_T0, 0x73));
+  jit_emit_u32(j, (0x20 << 25) | (JIT_REG_T2 << 20) | (JIT_REG_T0 << 15) |
+                      (JIT_REG_A0 << 7) | 0x33);
+}
+
+static void jit_emit_ret(jit_t *j) { jit_emit_u32(j, __asm_ret); }
+
+#else
+#error Unsupported target
+#endif
+
+#ifdef RUNNER_KERNEL
+
+// There is no exported way to get executable memory from a module anymore
+bool jit_init(jit_t *j, usize capacity) {
+  pr_err("jit: runtime code generation is not supported in RUNNER_KERNEL\n");
+  j->code = NULL;
+  j->capacity = 0;
+  j->len = 0;
+  j->overflow = true;
+  return false;
+}
+
+void jit_reset(jit_t *j) { j->len = 0; }
+jit_func_t jit_finalize(jit_t *j) { return NULL; }
+void jit_free(jit_t *j) {}
+
+#else
+#ifdef RUNNER_USER
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#define JIT_PAGE_SZ 4096
+
+bool jit_init(jit_t *j, usize capacity) {
+  capacity = ((capacity + JIT_PAGE_SZ - 1) / JIT_PAGE_SZ) * JIT_PAGE_SZ;
+
+  void *code = mmap(NULL, capacity, PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (code == MAP_FAILED)
+    return false;
+
+  j->code = code;
+  j->capacity = capacity;
+  j->len = 0;
+  j->overflow = false;
+  return true;
+}
+
+void jit_reset(jit_t *j) {
+  mprotect(j->code, j->capacity, PROT_READ | PROT_WRITE);
+  j->len = 0;
+  j->overflow = false;
+}
+
+jit_func_t jit_finalize(jit_t *j) {
+  jit_emit_ret(j);
+  if (j->overflow)
+    return NULL;
+
+  if (mprotect(j->code, j->capacity, PROT_READ | PROT_EXEC) != 0)
+    return NULL;
+
+  __builtin___clear_cache((char *)j->code, (char *)j->code + j->len);
+  return (jit_func_t)j->code;
+}
+
+void jit_free(jit_t *j) {
+  if (j->code)
+    munmap(j->code, j->capacity);
+  j->code = NULL;
+  j->capacity = 0;
+}
+
+#else
+#ifdef RUNNER_SIMULATION
+
+#include <stddef.h>
+
+// Bare metal, so a static buffer is already executable, it only needs the
+// instruction stream to be synchronised after writing
+#ifndef JIT_POOL_SZ
+#define JIT_POOL_SZ JIT_DEFAULT_CAP
+#endif
+
+static u8 jit_pool[JIT_POOL_SZ] __attribute__((aligned(4096)));
+static bool jit_pool_used = false;
+
+bool jit_init(jit_t *j, usize capacity) {
+  if (jit_pool_used || capacity > JIT_POOL_SZ)
+    return false;
+
+  jit_pool_used = true;
+  j->code = jit_pool;
+  j->capacity = JIT_POOL_SZ;
+  j->len = 0;
+  j->overflow = false;
+  return true;
+}
+
+void jit_reset(jit_t *j) {
+  j->len = 0;
+  j->overflow = false;
+}
+
+jit_func_t jit_finalize(jit_t *j) {
+  jit_emit_ret(j);
+  if (j->overflow)
+    return NULL;
+
+  __asm__ __volatile__("fence.i" ::: "memory");
+  return (jit_func_t)j->code;
+}
+
+void jit_free(jit_t *j) {
+  jit_pool_used = false;
+  j->code = NULL;
+  j->capacity = 0;
+}
+
+#else
+#error Unsupported target
+#endif
+#endif
+#endif
+
+#endif // _JIT_IMPLEMENTATION
@@ -13,9 +13,17 @@
 #define CACHE_LINE_ALIGNED __attribute__((aligned(CACHE_LINE_SZ)))
 #define CACHE_LINE_ALIGNED_PTR __attribute__((aligned(CACHE_LINE_SZ)))
 
+// Arena of a RUNNER_KERNEL test, enough for the branch tables and a few
+// pages. Tests with big buffers define KERNEL_ARENA_SZ on top of it.
+#define KERNEL_ARENA_DEFAULT_SZ (2UL * 1024 * 1024)
+
 void *alloc(usize);
+void *alloc_aligned(usize size, usize align);
+usize alloc_mark(void);
+void alloc_reset(usize mark);
 bool mem_protect(void *, usize, int);
 usize *get_kernel_ptr(void);
+usize *kernel_ptr_target(s32 cpu, u32 offset);
 usize get_kernel_time(void);
 void kernel_ptr_cache_flush(void);
 void kernel_ptr_cache(void);
@@ -23,66 +31,131 @@ void ker_open(void);
 void ker_close(void);
 void pte_clear_noflush(volatile char *page);
 void pte_restore_noflush(volatile char *page);
+bool pte_clear_noflush_batch(volatile char **pages, usize count);
+bool pte_restore_noflush_batch(volatile char **pages, usize count);
 void tlb_flush(void);
 void tlb_flush_page(volatile char *page);
+struct probe_op *probe_ring(void);
+bool probe_ring_submit(usize count);
+bool kernel_ptr_measure(struct probe_measure *m);
 
 #define no_inline __attribute__((__noinline__))
 #define no_tailcall __attribute__((__noinline__))
 
 #endif // _MEM
 
-#ifdef _MEM_IMPLEMENTATION
+#if defined(_MEM_IMPLEMENTATION) && !defined(_MEM_IMPLEMENTED)
+#define _MEM_IMPLEMENTED
 #ifdef RUNNER_KERNEL
 
 #include <asm-generic/barrier.h>
 #include <asm/tlbflush.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
-#include <linux/list.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/pgtable.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
+
+// Every test gets one arena reserved up front by __init_alloc(), alloc() just
+// bumps inside it. The test body runs with IRQs disabled, so nothing in the
+// alloc() path is allowed to sleep. Tests with big buffers can raise the size
+// by defining KERNEL_ARENA_SZ before including tester.c
+#ifndef KERNEL_ARENA_SZ
+#define KERNEL_ARENA_SZ KERNEL_ARENA_DEFAULT_SZ
+#endif
 
-struct alloc_entry {
-  void *ptr;
-  struct list_head list;
-};
-
-static LIST_HEAD(alloc_list);
-
-void __init_alloc(void) { INIT_LIST_HEAD(&alloc_list); }
+// Largest order the buddy allocator hands out, MAX_ORDER was exclusive
+// before 6.4 and renamed in 6.8
+#ifdef MAX_PAGE_ORDER
+#define ARENA_MAX_ORDER MAX_PAGE_ORDER
+#else
+#define ARENA_MAX_ORDER (MAX_ORDER - 1)
+#endif
 
-void *alloc(usize size) {
-  void *buf = kmalloc(size, GFP_KERNEL);
+static u8 *arena_base = NULL;
+static usize arena_offset = 0;
+static usize arena_size = 0;
+static int arena_order = -1; // -1 when the arena is vmalloc'd
+
+void __init_alloc(void) {
+  arena_size = PAGE_ALIGN(KERNEL_ARENA_SZ);
+  arena_offset = 0;
+  arena_order = -1;
+
+  // Physically contiguous when it fits in a buddy order, the big arenas are
+  // only virtually contiguous
+  if (get_order(arena_size) <= ARENA_MAX_ORDER) {
+    arena_order = get_order(arena_size);
+    arena_base = (u8 *)__get_free_pages(GFP_KERNEL | __GFP_NOWARN, arena_order);
+    if (!arena_base)
+      arena_order = -1;
+  }
+  if (!arena_base)
+    arena_base = vmalloc(arena_size);
+  if (!arena_base) {
+    pr_err("alloc: failed to reserve a %lu bytes arena\n",
+           (unsigned long)arena_size);
+    arena_size = 0;
+  }
+}
 
-  if (!buf)
+void *alloc_aligned(usize size, usize align) {
+  if (!arena_base)
     return NULL;
 
-  struct alloc_entry *entry;
-  entry = kmalloc(sizeof(*entry), GFP_KERNEL);
-  if (!entry) {
-    kfree(buf);
+  // Align the address and not the offset, the arena is only guaranteed to
+  // start on a page boundary
+  usize start =
+      ALIGN((usize)arena_base + arena_offset, align) - (usize)arena_base;
+  if (start + size > arena_size || start + size < start) {
+    pr_err("alloc: arena exhausted (%lu/%lu bytes used, %lu requested)\n",
+           (unsigned long)arena_offset, (unsigned long)arena_size,
+           (unsigned long)size);
     return NULL;
   }
 
-  entry->ptr = buf;
-  list_add(&entry->list, &alloc_list);
+  arena_offset = start + size;
+  return arena_base + start;
+}
 
-  return buf;
+void *alloc(usize size) {
+  usize true_size =
+      ((size + CACHE_LINE_SZ - 1) / CACHE_LINE_SZ) * CACHE_LINE_SZ;
+  if (true_size < size)
+    return NULL;
+
+  return alloc_aligned(true_size, CACHE_LINE_SZ);
 }
 
-void __deinit_alloc(void) {
-  struct alloc_entry *entry, *tmp;
+usize alloc_mark(void) { return arena_offset; }
 
-  list_for_each_entry_safe(entry, tmp, &alloc_list, list) {
-    kfree(entry->ptr);
-    list_del(&entry->list);
-    kfree(entry);
-  }
+void alloc_reset(usize mark) {
+  if (mark <= arena_offset)
+    arena_offset = mark;
 }
 
-static pte_t saved_pte;
-static pte_t *saved_ptep;
+void __deinit_alloc(void) {
+  if (arena_order >= 0)
+    free_pages((unsigned long)arena_base, arena_order);
+  else
+    vfree(arena_base);
+  arena_base = NULL;
+  arena_order = -1;
+  arena_offset = 0;
+  arena_size = 0;
+}
+
+// Saved PTEs keyed by page, the walked pte_t * is kept so clearing the same
+// page again skips the walk
+static struct {
+  unsigned long addr;
+  pte_t *ptep;
+  pte_t saved;
+  bool cleared;
+} saved_ptes[PROBE_PTE_SLOTS];
+static usize saved_ptes_count = 0;
 
 static pte_t *walk_to_pte(unsigned long addr) {
   unsigned long cr3_val;
@@ -128,40 +201,111 @@ static pte_t *walk_to_pte(unsigned long addr) {
   return ptep;
 }
 
-void pte_clear_noflush(volatile char *page) {
+static ssize saved_pte_slot(unsigned long addr, bool create) {
+  ssize idle = -1;
+
+  for (usize i = 0; i < saved_ptes_count; i++) {
+    if (saved_ptes[i].addr == addr)
+      return i;
+    if (idle < 0 && !saved_ptes[i].cleared)
+      idle = i;
+  }
+
+  if (!create)
+    return -1;
+
+  if (saved_ptes_count < PROBE_PTE_SLOTS)
+    idle = saved_ptes_count++;
+
+  if (idle < 0)
+    return -1;
+
+  saved_ptes[idle].addr = addr;
+  saved_ptes[idle].ptep = NULL;
+  saved_ptes[idle].cleared = false;
+  return idle;
+}
+
+static bool __pte_clear(volatile char *page) {
   unsigned long addr = (unsigned long)page & PAGE_MASK;
-  pte_t *ptep = walk_to_pte(addr);
+  ssize slot = saved_pte_slot(addr, true);
+  pte_t *ptep;
+
+  if (slot < 0) {
+    pr_err("pte_clear_noflush_kernel: no free PTE slot for %lx\n", addr);
+    return false;
+  }
+  if (saved_ptes[slot].cleared) {
+    pr_err("pte_clear_noflush_kernel: already cleared for %lx\n", addr);
+    return false;
+  }
+
+  ptep = saved_ptes[slot].ptep;
+  if (!ptep || !(pte_val(*ptep) & _PAGE_PRESENT) ||
+      pte_pfn(*ptep) != pte_pfn(saved_ptes[slot].saved))
+    ptep = walk_to_pte(addr);
 
   if (!ptep) {
     pr_err("pte_clear_noflush_kernel: walk failed for %lx\n", addr);
-    return;
+    return false;
   }
   if (!(pte_val(*ptep) & _PAGE_PRESENT)) {
     pr_err("pte_clear_noflush_kernel: already not-present for %lx\n", addr);
-    return;
+    return false;
   }
 
-  saved_pte = *ptep;
-  saved_ptep = ptep;
+  saved_ptes[slot].saved = *ptep;
+  saved_ptes[slot].ptep = ptep;
+  saved_ptes[slot].cleared = true;
 
-  native_set_pte(ptep, __pte(pte_val(saved_pte) & ~(pteval_t)_PAGE_PRESENT));
+  native_set_pte(ptep, __pte(pte_val(*ptep) & ~(pteval_t)_PAGE_PRESENT));
 
   asm volatile("clflush (%0)" ::"r"(ptep) : "memory");
+  return true;
+}
+
+static bool __pte_restore(volatile char *page) {
+  unsigned long addr = (unsigned long)page & PAGE_MASK;
+  ssize slot = saved_pte_slot(addr, false);
+
+  if (slot < 0 || !saved_ptes[slot].cleared) {
+    pr_err("pte_restore_noflush_kernel: no saved PTE for %lx\n", addr);
+    return false;
+  }
+
+  native_set_pte(saved_ptes[slot].ptep, saved_ptes[slot].saved);
+
+  asm volatile("clflush (%0)" ::"r"(saved_ptes[slot].ptep) : "memory");
+  saved_ptes[slot].cleared = false;
+  return true;
+}
+
+void pte_clear_noflush(volatile char *page) {
+  __pte_clear(page);
   asm volatile("mfence" ::: "memory");
 }
 
 void pte_restore_noflush(volatile char *page) {
-  if (!saved_ptep) {
-    pr_err("pte_restore_noflush_kernel: no saved PTE\n");
-    return;
-  }
+  __pte_restore(page);
+  asm volatile("mfence" ::: "memory");
+}
 
-  native_set_pte(saved_ptep, saved_pte);
+bool pte_clear_noflush_batch(volatile char **pages, usize count) {
+  bool ok = true;
+  for (usize i = 0; i < count; i++)
+    ok &= __pte_clear(pages[i]);
 
-  asm volatile("clflush (%0)" ::"r"(saved_ptep) : "memory");
   asm volatile("mfence" ::: "memory");
+  return ok;
+}
+
+bool pte_restore_noflush_batch(volatile char **pages, usize count) {
+  bool ok = true;
+  for (usize i = 0; i < count; i++)
+    ok &= __pte_restore(pages[i]);
 
-  saved_ptep = NULL;
+  asm volatile("mfence" ::: "memory");
+  return ok;
 }
 
 void tlb_flush() { __flush_tlb_all(); }
@@ -221,12 +365,22 @@ void tlb_flush_page(volatile char *page) {
 
 bool mem_protect(void *ptr, usize len, int prot) { return true; }
 
+// The test is pinned to one CPU already, a static buffer is enough here
+static u8 ____target[PROBE_TARGET_SZ] __attribute__((aligned(PAGE_SIZE)));
 volatile usize *____ptr = NULL;
 
-void ker_open() { ____ptr = kmalloc(sizeof(usize), GFP_KERNEL); };
-void ker_close() { kfree((void *)____ptr); };
+void ker_open() { ____ptr = (volatile usize *)____target; };
+void ker_close() { ____ptr = NULL; };
+
+usize *get_kernel_ptr(void) { return (usize *)____ptr; }
 
-usize *get_kernel_ptr(void) { return ____ptr; }
+usize *kernel_ptr_target(s32 cpu, u32 offset) {
+  if (offset >= PROBE_TARGET_SZ || offset % L1_CACHE_BYTES)
+    return NULL;
+
+  ____ptr = (volatile usize *)(____target + offset);
+  return (usize *)____ptr;
+}
 usize get_kernel_time(void) {
   ktime_t start, end;
   start = __builtin_ia32_rdtsc();
@@ -248,6 +402,78 @@ void kernel_ptr_cache(void) {
   load(____ptr);
 }
 
+// The test already runs with IRQs off, so there is nothing to chunk here
+bool kernel_ptr_measure(struct probe_measure *m) {
+  if (m->mode != PROBE_MEASURE_FLUSH_RELOAD && m->mode != PROBE_MEASURE_RELOAD)
+    return false;
+
+  probe_measure_reset(m);
+  if (m->mode == PROBE_MEASURE_RELOAD)
+    kernel_ptr_cache();
+
+  for (u64 i = 0; i < m->iterations; i++) {
+    if (m->mode == PROBE_MEASURE_FLUSH_RELOAD)
+      kernel_ptr_cache_flush();
+    memory_barrier();
+
+    probe_measure_add(m, get_kernel_time());
+  }
+
+  probe_measure_finish(m);
+  return true;
+}
+
+// Same interface as the probe device ring, here the ops are just run inline
+static struct probe_op ____ring[PROBE_RING_OPS];
+
+struct probe_op *probe_ring(void) { return ____ring; }
+
+bool probe_ring_submit(usize count) {
+  if (count > PROBE_RING_OPS)
+    return false;
+
+  for (usize i = 0; i < count; i++) {
+    struct probe_op *op = &____ring[i];
+
+    op->status = 0;
+    op->result = 0;
+
+    switch ((enum probe_op_kind)op->kind) {
+    case PROBE_OP_NOP:
+      break;
+    case PROBE_OP_FLUSH:
+      kernel_ptr_cache_flush();
+      break;
+    case PROBE_OP_CACHE:
+      kernel_ptr_cache();
+      break;
+    case PROBE_OP_TIME_LOAD:
+      op->result = get_kernel_time();
+      break;
+    case PROBE_OP_TLB_FLUSH:
+      tlb_flush();
+      break;
+    case PROBE_OP_TLB_FLUSH_PAGE:
+      tlb_flush_page((volatile char *)op->addr);
+      break;
+    case PROBE_OP_PTE_CLEAR:
+      pte_clear_noflush((volatile char *)op->addr);
+      break;
+    case PROBE_OP_PTE_RESTORE:
+      pte_restore_noflush((volatile char *)op->addr);
+      break;
+    case PROBE_OP_BARRIER:
+      memory_barrier();
+      break;
+    default:
+      op->status = -EINVAL;
+      break;
+    }
+  }
+
+  return true;
+}
+
 #else
 #ifdef RUNNER_USER
 
@@ -306,24 +532,44 @@ bool mem_protect(void *ptr, usize len, int prot) {
   return mprotect(ptr, len, prot);
 }
 
-void *alloc(usize size) {
-  usize true_size =
-      ((size + CACHE_LINE_SZ - 1) / CACHE_LINE_SZ) * CACHE_LINE_SZ;
+void *alloc_aligned(usize size, usize align) {
   void *buf;
 
-  if (posix_memalign(&buf, CACHE_LINE_SZ, true_size) != 0)
+  if (align < sizeof(void *))
+    align = sizeof(void *);
+
+  if (posix_memalign(&buf, align, size ? size : 1) != 0)
     return NULL;
 
   da_append(&alloc_list, buf);
   return buf;
 }
 
+void *alloc(usize size) {
+  usize true_size =
+      ((size + CACHE_LINE_SZ - 1) / CACHE_LINE_SZ) * CACHE_LINE_SZ;
+
+  return alloc_aligned(true_size, CACHE_LINE_SZ);
+}
+
+// Here a mark is the number of live allocations
+usize alloc_mark(void) { return alloc_list.count; }
+
+void alloc_reset(usize mark) {
+  for (usize i = mark; i < alloc_list.count; i++)
+    free(alloc_list.items[i]);
+
+  if (mark < alloc_list.count)
+    alloc_list.count = mark;
+}
+
 void __deinit_alloc(void) {
   da_foreach(void *, buf, &alloc_list) { free(*buf); }
   da_free(&alloc_list);
 }
 
 int fd_kernel;
+static struct probe_op *ring_kernel = NULL;
 #include <stdio.h>
 void ker_open() {
   fd_kernel = open("/dev/probe_device", O_RDWR);
@@ -332,9 +578,57 @@ void ker_open() {
     printf("Failed to open device");
     return;
   }
+
+  ring_kernel = mmap(NULL, PROBE_RING_SZ, PROT_READ | PROT_WRITE, MAP_SHARED,
+                     fd_kernel, 0);
+  if (ring_kernel == MAP_FAILED) {
+    perror("Failed to map the probe ring");
+    ring_kernel = NULL;
+  }
 }
 
-void ker_close() { close(fd_kernel); }
+void ker_close() {
+  if (ring_kernel)
+    munmap(ring_kernel, PROBE_RING_SZ);
+  ring_kernel = NULL;
+  close(fd_kernel);
+}
+
+struct probe_op *probe_ring(void) { return ring_kernel; }
+
+bool probe_ring_submit(usize count) {
+  int ret = ioctl(fd_kernel, PROBE_RING_SUBMIT, count);
+  if (ret < 0) {
+    perror("Failed to open ioclt");
+    return false;
+  }
+
+  return true;
+}
+
+usize *kernel_ptr_target(s32 cpu, u32 offset) {
+  struct probe_target target = {0};
+  target.cpu = cpu;
+  target.offset = offset;
+
+  int ret = ioctl(fd_kernel, PROBE_SET_TARGET, &target);
+  if (ret < 0) {
+    perror("Failed to open ioclt");
+    return NULL;
+  }
+
+  return (usize *)target.addr;
+}
+
+bool kernel_ptr_measure(struct probe_measure *m) {
+  int ret = ioctl(fd_kernel, PROBE_MEASURE, m);
+  if (ret < 0) {
+    perror("Failed to open ioclt");
+    return false;
+  }
+
+  return true;
+}
 
 usize *get_kernel_ptr(void) {
   struct probe_request req = {0};
@@ -423,6 +717,34 @@ void pte_restore_noflush(volatile char *page) {
   }
 }
 
+bool pte_clear_noflush_batch(volatile char **pages, usize count) {
+  struct probe_pte_batch batch = {0};
+  batch.count = count;
+  batch.addrs = (usize *)pages;
+
+  int ret = ioctl(fd_kernel, PROBE_PTE_CLEAR_BATCH, &batch);
+  if (ret < 0) {
+    perror("Failed to open ioclt");
+    return false;
+  }
+
+  return true;
+}
+
+bool pte_restore_noflush_batch(volatile char **pages, usize count) {
+  struct probe_pte_batch batch = {0};
+  batch.count = count;
+  batch.addrs = (usize *)pages;
+
+  int ret = ioctl(fd_kernel, PROBE_PTE_RESTORE_BATCH, &batch);
+  if (ret < 0) {
+    perror("Failed to open ioclt");
+    return false;
+  }
+
+  return true;
+}
+
 void tlb_flush_page(volatile char *page) {
   struct probe_request req = {0};
   req.ret = (usize *)page;
@@ -444,42 +766,62 @@ void tlb_flush() {
 #ifdef RUNNER_SIMULATION
 
 #define CACHE_LINE_SZ 4096
-#define HEAP_SIZE (CACHE_LINE_SZ * 128)
-/* #define HEAP_SIZE (CACHE_LINE_SZ * 1) */
-#define HEAP_ALIGN CACHE_LINE_SZ
 
-// Simple static heap
-static u8 heap[HEAP_SIZE];
-static usize heap_offset = 0;
+// The orchestrator sets it with --heap-size
+#ifndef SIM_HEAP_SIZE
+#define SIM_HEAP_SIZE (CACHE_LINE_SZ * 128)
+#endif
 
-// Align a value up to nearest multiple of HEAP_ALIGN
-static inline usize align_up(usize size) {
-  return (size + HEAP_ALIGN - 1) & ~(HEAP_ALIGN - 1);
-}
+// Alignment of calloc(), same as a hosted malloc
+#define HEAP_MIN_ALIGN (2 * sizeof(usize))
 
-void *alloc(usize size) {
-  size = align_up(size);
-  if (heap_offset + size > HEAP_SIZE) {
+// Simple static heap, alloc_mark()/alloc_reset() give back everything
+// allocated after the mark
+static u8 heap[SIM_HEAP_SIZE] __attribute__((aligned(CACHE_LINE_SZ)));
+static usize heap_offset = 0;
+
+void *alloc_aligned(usize size, usize align) {
+  usize start = (heap_offset + align - 1) & ~(align - 1);
+  if (start + size > SIM_HEAP_SIZE || start + size < start) {
     // Out of memory
     return NULL;
   }
-  void *ptr = &heap[heap_offset];
-  heap_offset += size;
-  return ptr;
+
+  heap_offset = start + size;
+  return &heap[start];
 }
 
+// Page aligned, the size does not need rounding as the next allocation
+// aligns itself
+void *alloc(usize size) { return alloc_aligned(size, CACHE_LINE_SZ); }
+
 void *calloc(usize nmemb, usize size) {
-  usize total = nmemb * size;
-  void *ptr = alloc(total);
+  usize total;
+  if (__builtin_mul_overflow(nmemb, size, &total))
+    return NULL;
+
+  void *ptr = alloc_aligned(total, HEAP_MIN_ALIGN);
   if (!ptr)
     return NULL;
-  for (usize i = 0; i < total; i++)
+
+  usize *words = ptr;
+  usize i = 0;
+  for (; i < total / sizeof(usize); i++)
+    words[i] = 0;
+  for (i *= sizeof(usize); i < total; i++)
     ((u8 *)ptr)[i] = 0;
   return ptr;
 }
 
+usize alloc_mark(void) { return heap_offset; }
+
+void alloc_reset(usize mark) {
+  if (mark <= heap_offset)
+    heap_offset = mark;
+}
+
 void __init_alloc(void) {}
-void __deinit_alloc(void) {}
+void __deinit_alloc(void) { heap_offset = 0; }
 
 #else
 #error Unsupported target
@@ -1,108 +1,281 @@
 #ifndef __RAND
 #define __RAND
-/* A C-program for MT19937: Integer version (1998/4/6)            */
-/*  genrand() generates one pseudorandom unsigned integer (32bit) */
-/* which is uniformly distributed among 0 to 2^32-1  for each     */
-/* call. sgenrand(seed) set initial values to the working area    */
-/* of 624 words. Before genrand(), sgenrand(seed) must be         */
-/* called once. (seed is any 32-bit integer except for 0).        */
-/*   Coded by Takuji Nishimura, considering the suggestions by    */
-/* Topher Cooper and Marc Rieffel in July-Aug. 1997.              */
-
-/* This library is free software; you can redistribute it and/or   */
-/* modify it under the terms of the GNU Library General Public     */
-/* License as published by the Free Software Foundation; either    */
-/* version 2 of the License, or (at your option) any later         */
-/* version.                                                        */
-/* This library is distributed in the hope that it will be useful, */
-/* but WITHOUT ANY WARRANTY; without even the implied warranty of  */
-/* MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.            */
-/* See the GNU Library General Public License for more details.    */
-/* You should have received a copy of the GNU Library General      */
-/* Public License along with this library; if not, write to the    */
-/* Free Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA   */
-/* 02111-1307  USA                                                 */
-
-/* Copyright (C) 1997 Makoto Matsumoto and Takuji Nishimura.       */
-/* When you use this, send an email to: matumoto@math.keio.ac.jp   */
-/* with an appropriate reference to your work.                     */
-
-/* REFERENCE                                                       */
-/* M. Matsumoto and T. Nishimura,                                  */
-/* "Mersenne Twister: A 623-Dimensionally Equidistributed Uniform  */
-/* Pseudo-Random Number Generator",                                */
-/* ACM Transactions on Modeling and Computer Simulation,           */
-/* Vol. 8, No. 1, January 1998, pp 3--30.                          */
-
-/* Period parameters */
-#define __MT_N 624
-#define __MT_M 397
-#define __MT_MATRIX_A 0x9908b0df   /* constant vector a */
-#define __MT_UPPER_MASK 0x80000000 /* most significant w-r bits */
-#define __MT_LOWER_MASK 0x7fffffff /* least significant r bits */
-
-/* Tempering parameters */
-#define __MT_TEMPERING_MASK_B 0x9d2c5680
-#define __MT_TEMPERING_MASK_C 0xefc60000
-#define __MT_TEMPERING_SHIFT_U(y) (y >> 11)
-#define __MT_TEMPERING_SHIFT_S(y) (y << 7)
-#define __MT_TEMPERING_SHIFT_T(y) (y << 15)
-#define __MT_TEMPERING_SHIFT_L(y) (y >> 18)
-
-static unsigned long mt[__MT_N]; /* the array for the state vector  */
-static int mti = __MT_N + 1;     /* mti==N+1 means mt[N] is not initialized */
 
+#include "types.h"
+
+// xoshiro256** by David Blackman and Sebastiano Vigna (public domain), with
+// the state kept in explicit objects instead of globals so that threads do
+// not race on it.
+//
+// Every run has a seed, chosen by the orchestrator and passed in
+// calibration_t. The tester mixes it with the module name in rand_init_run()
+// and every thread (CPU in the kernel, hart in the simulation) then gets its
+// own stream from rand_thread(). get_rand() and friends draw from it.
+
+typedef struct {
+  u64 s[4];
+} rand_state_t;
+
+// Generators stepped together by the bulk fills, the loop over them is what
+// the compiler vectorizes
+#define RAND_LANES 8
+
+static inline u64 rand_rotl(u64 x, u32 k) { return (x << k) | (x >> (64 - k)); }
+
+static inline u64 rand_splitmix64(u64 *x) {
+  u64 z = (*x += 0x9e3779b97f4a7c15ULL);
+  z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+  z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+  return z ^ (z >> 31);
+}
+
+// FNV-1a, turns a module name into a stream id
+static inline u64 rand_hash(const char *s) {
+  u64 h = 0xcbf29ce484222325ULL;
+  for (; *s; s++)
+    h = (h ^ (u8)*s) * 0x100000001b3ULL;
+  return h;
+}
+
+// Streams of the same seed are independent for any practical purpose
+static inline void rand_seed(rand_state_t *r, u64 seed, u64 stream) {
+  u64 x = seed;
+  x ^= rand_splitmix64(&stream);
+  for (usize i = 0; i < 4; i++)
+    r->s[i] = rand_splitmix64(&x);
+}
+
+static inline u64 rand_next(rand_state_t *r) {
+  u64 *s = r->s;
+  const u64 result = rand_rotl(s[1] * 5, 7) * 9;
+  const u64 t = s[1] << 17;
+
+  s[2] ^= s[0];
+  s[3] ^= s[1];
+  s[1] ^= s[2];
+  s[0] ^= s[3];
+  s[2] ^= t;
+  s[3] = rand_rotl(s[3], 45);
+
+  return result;
+}
+
+// Uniform in [0, bound), Lemire's multiply and reject, no division on the
+// common path. 0 for an empty range.
+static inline u32 rand_below(rand_state_t *r, u32 bound) {
+  if (bound == 0)
+    return 0;
+
+  u64 m = (u64)(u32)(rand_next(r) >> 32) * bound;
+  if ((u32)m < bound) {
+    const u32 threshold = -bound % bound;
+    while ((u32)m < threshold)
+      m = (u64)(u32)(rand_next(r) >> 32) * bound;
+  }
+
+  return m >> 32;
+}
+
+// Uniform in [low, high]
+static inline u64 rand_range(rand_state_t *r, u64 low, u64 high) {
+  const u64 span = high - low + 1;
+  if (span == 0)
+    return rand_next(r); // The whole u64 range
+  if (span <= 0xffffffffULL)
+    return low + rand_below(r, span);
+
+  const u64 threshold = -span % span;
+  u64 x;
+  do {
+    x = rand_next(r);
+  } while (x < threshold);
+
+  return low + x % span;
+}
+
+// Fills `buf` from RAND_LANES generators seeded from `r`, which only moves
+// by one step
+static inline void rand_fill_u32(rand_state_t *r, u32 *buf, usize n) {
+  u64 s0[RAND_LANES], s1[RAND_LANES], s2[RAND_LANES], s3[RAND_LANES];
+
+  u64 x = rand_next(r);
+  for (usize l = 0; l < RAND_LANES; l++) {
+    s0[l] = rand_splitmix64(&x);
+    s1[l] = rand_splitmix64(&x);
+    s2[l] = rand_splitmix64(&x);
+    s3[l] = rand_splitmix64(&x);
+  }
+
+  usize i = 0;
+  for (; i + RAND_LANES <= n; i += RAND_LANES) {
+    for (usize l = 0; l < RAND_LANES; l++) {
+      const u64 result = rand_rotl(s1[l] * 5, 7) * 9;
+      const u64 t = s1[l] << 17;
+
+      s2[l] ^= s0[l];
+      s3[l] ^= s1[l];
+      s1[l] ^= s2[l];
+      s0[l] ^= s3[l];
+      s2[l] ^= t;
+      s3[l] = rand_rotl(s3[l], 45);
+
+      buf[i + l] = result >> 32;
+    }
+  }
+
+  for (; i < n; i++)
+    buf[i] = rand_next(r) >> 32;
+}
+
+// Same as rand_fill_u32() reduced to [0, bound). The values Lemire's method
+// would reject are drawn again one by one, so there is no bias. All 0 for an
+// empty range.
+static inline void rand_fill_below(rand_state_t *r, u32 *buf, usize n,
+                                   u32 bound) {
+  if (bound == 0) {
+    for (usize i = 0; i < n; i++)
+      buf[i] = 0;
+    return;
+  }
+
+  rand_fill_u32(r, buf, n);
+
+  const u32 threshold = -bound % bound;
+  for (usize i = 0; i < n; i++) {
+    const u64 m = (u64)buf[i] * bound;
+    buf[i] = (u32)m < threshold ? rand_below(r, bound) : (u32)(m >> 32);
+  }
+}
+
+void rand_init_run(u64 run_seed, const char *module);
+rand_state_t *rand_thread(void);
+
+static inline void fill_random_u32(u32 *buf, usize n) {
+  rand_fill_u32(rand_thread(), buf, n);
+}
+
+static inline void fill_random_below(u32 *buf, usize n, u32 bound) {
+  rand_fill_below(rand_thread(), buf, n, bound);
+}
+
+// Previous interface, on the stream of the calling thread
 void set_seed(unsigned long seed);
 unsigned long get_rand(void);
 unsigned long get_rand_in_range(unsigned long low, unsigned long high);
 
-/* initializing the array with a NONZERO seed */
-void set_seed(unsigned long seed) {
-  /* setting initial seeds to mt[N] using         */
-  /* the generator Line 25 of Table 1 in          */
-  /* [KNUTH 1981, The Art of Computer Programming */
-  /*    Vol. 2 (2nd Ed.), pp102]                  */
-  mt[0] = seed & 0xffffffff;
-  for (mti = 1; mti < __MT_N; mti++)
-    mt[mti] = (69069 * mt[mti - 1]) & 0xffffffff;
+#endif // __RAND
+
+#if defined(_RAND_IMPLEMENTATION) && !defined(_RAND_IMPLEMENTED)
+#define _RAND_IMPLEMENTED
+
+// Used when a test runs without rand_init_run()
+#define RAND_DEFAULT_SEED 4357
+
+static u64 rand_run_seed = RAND_DEFAULT_SEED;
+
+// Bumped by rand_init_run(), a thread whose state is older seeds it again
+static u32 rand_generation = 1;
+
+#ifdef RUNNER_KERNEL
+
+#include <linux/percpu.h>
+#include <linux/smp.h>
+
+// One stream per CPU, the tests run with preemption disabled
+static DEFINE_PER_CPU(rand_state_t, rand_cpu_state);
+static DEFINE_PER_CPU(u32, rand_cpu_generation);
+
+void rand_init_run(u64 run_seed, const char *module) {
+  rand_run_seed = run_seed ^ rand_hash(module);
+  WRITE_ONCE(rand_generation, rand_generation + 1);
 }
 
-unsigned long get_rand(void) {
-  unsigned long y;
-  static unsigned long mag01[2] = {0x0, __MT_MATRIX_A};
-  /* mag01[x] = x * MATRIX_A  for x=0,1 */
+rand_state_t *rand_thread(void) {
+  const u32 generation = READ_ONCE(rand_generation);
+  rand_state_t *r = raw_cpu_ptr(&rand_cpu_state);
 
-  if (mti >= __MT_N) { /* generate N words at one time */
-    int kk;
+  if (raw_cpu_read(rand_cpu_generation) != generation) {
+    rand_seed(r, rand_run_seed, raw_smp_processor_id());
+    raw_cpu_write(rand_cpu_generation, generation);
+  }
 
-    if (mti == __MT_N + 1) /* if sgenrand() has not been called, */
-      set_seed(4357);      /* a default initial seed is used   */
+  return r;
+}
 
-    for (kk = 0; kk < __MT_N - __MT_M; kk++) {
-      y = (mt[kk] & __MT_UPPER_MASK) | (mt[kk + 1] & __MT_LOWER_MASK);
-      mt[kk] = mt[kk + __MT_M] ^ (y >> 1) ^ mag01[y & 0x1];
-    }
-    for (; kk < __MT_N - 1; kk++) {
-      y = (mt[kk] & __MT_UPPER_MASK) | (mt[kk + 1] & __MT_LOWER_MASK);
-      mt[kk] = mt[kk + (__MT_M - __MT_N)] ^ (y >> 1) ^ mag01[y & 0x1];
-    }
-    y = (mt[__MT_N - 1] & __MT_UPPER_MASK) | (mt[0] & __MT_LOWER_MASK);
-    mt[__MT_N - 1] = mt[__MT_M - 1] ^ (y >> 1) ^ mag01[y & 0x1];
+#else
+#ifdef RUNNER_USER
 
-    mti = 0;
+// One stream per thread, numbered in the order they first draw
+static __thread rand_state_t rand_thread_state;
+static __thread u32 rand_thread_generation;
+static u32 rand_streams = 0;
+
+void rand_init_run(u64 run_seed, const char *module) {
+  rand_run_seed = run_seed ^ rand_hash(module);
+  __atomic_store_n(&rand_streams, 0, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&rand_generation, 1, __ATOMIC_RELEASE);
+}
+
+rand_state_t *rand_thread(void) {
+  const u32 generation = __atomic_load_n(&rand_generation, __ATOMIC_ACQUIRE);
+
+  if (rand_thread_generation != generation) {
+    const u32 stream =
+        __atomic_fetch_add(&rand_streams, 1, __ATOMIC_RELAXED);
+    rand_seed(&rand_thread_state, rand_run_seed, stream);
+    rand_thread_generation = generation;
   }
 
-  y = mt[mti++];
-  y ^= __MT_TEMPERING_SHIFT_U(y);
-  y ^= __MT_TEMPERING_SHIFT_S(y) & __MT_TEMPERING_MASK_B;
-  y ^= __MT_TEMPERING_SHIFT_T(y) & __MT_TEMPERING_MASK_C;
-  y ^= __MT_TEMPERING_SHIFT_L(y);
+  return &rand_thread_state;
+}
+
+#else
+#ifdef RUNNER_SIMULATION
+
+// One stream per hart, the threads of a hart are cooperative so they can
+// share it. NUM_HARTS has the same default as in thread.h.
+#ifndef NUM_HARTS
+#define NUM_HARTS 4
+#endif
+
+static rand_state_t rand_hart_state[NUM_HARTS];
+static u32 rand_hart_generation[NUM_HARTS];
 
-  return y;
+void rand_init_run(u64 run_seed, const char *module) {
+  rand_run_seed = run_seed ^ rand_hash(module);
+  __atomic_add_fetch(&rand_generation, 1, __ATOMIC_RELEASE);
 }
 
+rand_state_t *rand_thread(void) {
+  usize hart;
+  __asm__ __volatile__("csrr %0, mhartid" : "=r"(hart));
+  hart %= NUM_HARTS;
+
+  const u32 generation = __atomic_load_n(&rand_generation, __ATOMIC_ACQUIRE);
+  if (rand_hart_generation[hart] != generation) {
+    rand_seed(&rand_hart_state[hart], rand_run_seed, hart);
+    rand_hart_generation[hart] = generation;
+  }
+
+  return &rand_hart_state[hart];
+}
+
+#else
+#error Unsupported runner
+#endif
+#endif
+#endif
+
+// Restarts the stream of the calling thread from `seed`
+void set_seed(unsigned long seed) {
+  rand_seed(rand_thread(), seed, 0);
+}
+
+// 32 bits, like the Mersenne Twister it replaces
+unsigned long get_rand(void) { return rand_next(rand_thread()) >> 32; }
+
 unsigned long get_rand_in_range(unsigned long low, unsigned long high) {
-  return low + get_rand() % (high - low + 1);
+  return rand_range(rand_thread(), low, high);
 }
 
-#endif // __RAND
+#endif // _RAND_IMPLEMENTATION
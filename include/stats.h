@@ -0,0 +1,173 @@
+#ifndef _STATS
+#define _STATS
+
+#include "types.h"
+
+// Robust statistics for the cycle samples of the tests, so that large sample
+// sets can be reduced on the target before the result is copied out. No
+// allocation, no libc and no floating point, every runner can use it: the
+// means are fix64 with FP_SHIFT fractional bits.
+//
+// The order statistics work in place with quickselect and reorder the
+// samples they are given.
+
+static inline void stats_swap(u64 *a, u64 *b) {
+  const u64 t = *a;
+  *a = *b;
+  *b = t;
+}
+
+// k-th smallest of v[0..n), after which v[k] holds it, everything before is
+// not greater and everything after not smaller. 0 without samples.
+static inline u64 stats_select(u64 *v, usize n, usize k) {
+  if (n == 0)
+    return 0;
+
+  usize lo = 0, hi = n - 1;
+
+  while (lo < hi) {
+    // Median of three as the pivot, sorted samples are common
+    const usize mid = lo + (hi - lo) / 2;
+    if (v[mid] < v[lo])
+      stats_swap(&v[mid], &v[lo]);
+    if (v[hi] < v[lo])
+      stats_swap(&v[hi], &v[lo]);
+    if (v[hi] < v[mid])
+      stats_swap(&v[hi], &v[mid]);
+    const u64 pivot = v[mid];
+
+    usize i = lo, j = hi;
+    while (i <= j) {
+      while (v[i] < pivot)
+        i++;
+      while (v[j] > pivot)
+        j--;
+      if (i <= j) {
+        stats_swap(&v[i], &v[j]);
+        i++;
+        if (j == 0)
+          break;
+        j--;
+      }
+    }
+
+    if (k <= j)
+      hi = j;
+    else if (k >= i)
+      lo = i;
+    else
+      break; // Between the two halves, equal to the pivot
+  }
+
+  return v[k];
+}
+
+// Upper median for an even n
+static inline u64 stats_median(u64 *v, usize n) {
+  return stats_select(v, n, n / 2);
+}
+
+// Nearest rank, the smallest sample with at least `percent` of them not
+// greater, `percent` in [0, 100]
+static inline u64 stats_percentile(u64 *v, usize n, u32 percent) {
+  const u64 rank = ((u64)n * percent + 99) / 100;
+  return stats_select(v, n, rank > 0 ? (usize)rank - 1 : 0);
+}
+
+// sum / count as fix64, without shifting the whole sum
+static inline fix64 stats_fx_div(u64 sum, u64 count) {
+  return ((sum / count) << FP_SHIFT) + ((sum % count) << FP_SHIFT) / count;
+}
+
+// Mean of what is left after dropping `percent` of the samples from each
+// side, so a few interrupts or cold misses do not move it
+static inline fix64 stats_trimmed_mean(u64 *v, usize n, u32 percent) {
+  if (n == 0)
+    return 0;
+
+  usize cut = (usize)((u64)n * percent / 100);
+  if (2 * cut >= n)
+    cut = (n - 1) / 2;
+
+  // The two selections leave the kept samples in v[cut..n - cut)
+  if (cut > 0) {
+    stats_select(v, n, cut);
+    stats_select(v + cut, n - cut, n - 2 * cut - 1);
+  }
+
+  u64 sum = 0;
+  for (usize i = cut; i < n - cut; i++)
+    sum += v[i];
+
+  return stats_fx_div(sum, n - 2 * cut);
+}
+
+// Median absolute deviation, v is overwritten with the deviations
+static inline u64 stats_mad(u64 *v, usize n) {
+  const u64 m = stats_median(v, n);
+  for (usize i = 0; i < n; i++)
+    v[i] = v[i] > m ? v[i] - m : m - v[i];
+
+  return stats_median(v, n);
+}
+
+static inline u64 stats_isqrt(u64 x) {
+  u64 res = 0;
+  u64 bit = (u64)1 << 62;
+
+  while (bit > x)
+    bit >>= 2;
+
+  while (bit != 0) {
+    if (x >= res + bit) {
+      x -= res + bit;
+      res = (res >> 1) + bit;
+    } else {
+      res >>= 1;
+    }
+    bit >>= 2;
+  }
+
+  return res;
+}
+
+// Welford's online mean and variance, for samples that are not kept. The
+// squared deviations need 128 bits, only multiplications and shifts are done
+// on them since the kernel has no 128 bit division.
+typedef struct {
+  u64 n;
+  s64 mean; // fix64
+  __int128 m2;
+} stats_online_t;
+
+// Samples up to 2^47 cycles
+static inline void stats_online_add(stats_online_t *s, u64 x) {
+  const s64 fx = (s64)(x << FP_SHIFT);
+
+  s->n++;
+  const s64 delta = fx - s->mean;
+  s->mean += delta / (s64)s->n;
+  s->m2 += (__int128)delta * (fx - s->mean);
+}
+
+static inline fix64 stats_online_mean(const stats_online_t *s) {
+  return s->mean;
+}
+
+// Sample variance as fix64, saturated
+static inline fix64 stats_online_variance(const stats_online_t *s) {
+  if (s->n < 2 || s->m2 <= 0)
+    return 0;
+
+  const unsigned __int128 m2 = (unsigned __int128)s->m2 >> FP_SHIFT;
+  if (m2 >> 64)
+    return ~(fix64)0;
+
+  return (u64)m2 / (s->n - 1);
+}
+
+static inline fix64 stats_online_stddev(const stats_online_t *s) {
+  return stats_isqrt(stats_online_variance(s)) << (FP_SHIFT / 2);
+}
+
+#endif // _STATS
@@ -9,13 +9,267 @@ bool thread_create(thread_t *restrict thread, void *(*start_routine)(void *),
 
 bool thread_join(thread_t thread, void **retval);
 
+// Sense-reversing spin barrier
+typedef struct {
+  volatile u32 count;
+  volatile u32 sense;
+  u32 total;
+  volatile u32 parked; // Waiters asleep on sense instead of spinning
+} thread_barrier_t;
+
+#define THREAD_POOL_MAX 8
+
+struct thread_pool;
+
+struct thread_pool_slot {
+  struct thread_pool *pool;
+  usize idx;
+  u32 sense;
+  bool park; // Shares its CPU with another worker of the run
+  void *retval;
+};
+
+// A set of workers pinned to `cpus` when the pool is created. Every
+// thread_pool_start() runs the routine once on all of them, they leave the
+// start barrier together so their start times differ by a few cycles. The
+// pool must not move while it is alive.
+//
+// thread_pool_start_some() runs it only on the workers whose bit is set in
+// `active`, the others stay asleep. Workers of a run that share a CPU sleep in
+// the start barrier instead of spinning, so they do not keep each other off
+// it.
+typedef struct thread_pool {
+  usize count;
+  usize cpus[THREAD_POOL_MAX];
+  thread_t workers[THREAD_POOL_MAX];
+  struct thread_pool_slot slots[THREAD_POOL_MAX];
+
+  void *(*routine)(void *);
+  void *args[THREAD_POOL_MAX];
+  u32 active; // One bit per worker of the current run
+
+  thread_barrier_t start;
+  volatile u32 generation;
+  volatile u32 done;
+  volatile bool abort;
+  volatile bool stopping;
+} thread_pool_t;
+
+bool thread_pool_create(thread_pool_t *pool, usize count, const usize cpus[]);
+bool thread_pool_start(thread_pool_t *pool, void *(*routine)(void *),
+                       void *args[]);
+bool thread_pool_start_some(thread_pool_t *pool, u32 active,
+                            void *(*routine)(void *), void *args[]);
+bool thread_pool_join(thread_pool_t *pool, void *retvals[]);
+void thread_pool_destroy(thread_pool_t *pool);
+
+#ifdef RUNNER_KERNEL
+bool __init_threads(void);
+void __deinit_threads(void);
+
+// CPU waiting for the test to finish, -1 when none
+void __thread_set_issuer(s32 cpu);
+#endif
+
 /* #define noinline __attribute__((noinline)) */
 
 #endif // _THREAD
 
-#ifdef _THREAD_IMPLEMENTATION
+#if defined(_THREAD_IMPLEMENTATION) && !defined(_THREAD_IMPLEMENTED)
+#define _THREAD_IMPLEMENTED
 #ifdef RUNNER_KERNEL
-#error TODO
+
+#include <linux/completion.h>
+#include <linux/cpumask.h>
+#include <linux/kthread.h>
+#include <linux/sched.h>
+#include <linux/sched/clock.h>
+#include <linux/slab.h>
+#include <linux/wait.h>
+
+// The test itself runs with IRQs disabled, where nothing can sleep, so one
+// worker kthread per online CPU is created up front by __init_threads() and
+// thread_create() only hands it the routine. Only one thread per CPU can be
+// alive at a time and never on the CPU of the test or on the one that issued
+// it, which spins with preemption disabled until the test returns: a worker
+// could not run on either.
+
+// How long thread_create() waits for the worker to get on its CPU
+#define THREAD_START_TIMEOUT_NS (100 * NSEC_PER_MSEC)
+
+struct thread_impl_t {
+  struct task_struct *task;
+  wait_queue_head_t wq;
+  struct completion done;
+
+  void *(*start_routine)(void *);
+  void *arg;
+  void *retval;
+
+  volatile bool pending;
+  volatile bool busy;
+  volatile bool running;
+  volatile bool go;
+  volatile bool cancelled;
+};
+
+static struct thread_impl_t *thread_workers = NULL;
+static s32 thread_issuer_cpu = -1;
+
+void __thread_set_issuer(s32 cpu) { WRITE_ONCE(thread_issuer_cpu, cpu); }
+
+static int thread_worker(void *data) {
+  struct thread_impl_t *t = data;
+
+  while (!kthread_should_stop()) {
+    wait_event_interruptible(t->wq,
+                             READ_ONCE(t->pending) || kthread_should_stop());
+    if (!READ_ONCE(t->pending))
+      continue;
+    WRITE_ONCE(t->pending, false);
+
+    // Spin start: tell the creator we are on the CPU and wait for its go,
+    // so both sides enter the measured region a few cycles apart
+    preempt_disable();
+    smp_store_release(&t->running, true);
+    while (!smp_load_acquire(&t->go))
+      cpu_relax();
+
+    // The creator gave up waiting for us, nobody will join
+    if (READ_ONCE(t->cancelled)) {
+      preempt_enable();
+      smp_store_release(&t->busy, false);
+      continue;
+    }
+
+    t->retval = t->start_routine(t->arg);
+    preempt_enable();
+
+    complete(&t->done);
+  }
+
+  return 0;
+}
+
+bool __init_threads(void) {
+  unsigned int cpu;
+
+  thread_workers = kcalloc(nr_cpu_ids, sizeof(*thread_workers), GFP_KERNEL);
+  if (!thread_workers)
+    return false;
+
+  for_each_online_cpu(cpu) {
+    struct thread_impl_t *t = &thread_workers[cpu];
+
+    init_waitqueue_head(&t->wq);
+    init_completion(&t->done);
+
+    t->task = kthread_create_on_cpu(thread_worker, t, cpu, "tester_thread/%u");
+    if (IS_ERR(t->task)) {
+      pr_err("thread: failed to create the worker for CPU %u\n", cpu);
+      t->task = NULL;
+      continue;
+    }
+
+    wake_up_process(t->task);
+  }
+
+  return true;
+}
+
+void __deinit_threads(void) {
+  unsigned int cpu;
+
+  if (!thread_workers)
+    return;
+
+  for_each_online_cpu(cpu) {
+    if (thread_workers[cpu].task)
+      kthread_stop(thread_workers[cpu].task);
+  }
+
+  kfree(thread_workers);
+  thread_workers = NULL;
+}
+
+bool thread_create(struct thread_impl_t **thread,
+                   void *(*start_routine)(void *), void *arg, usize cpu) {
+  struct thread_impl_t *t;
+  u64 start;
+
+  if (!thread || !thread_workers || cpu >= nr_cpu_ids)
+    return false;
+
+  if (cpu == smp_processor_id()) {
+    pr_err("thread: CPU %llu is running the test itself\n", cpu);
+    return false;
+  }
+
+  if ((s64)cpu == READ_ONCE(thread_issuer_cpu)) {
+    pr_err("thread: CPU %llu is waiting for the test to finish\n", cpu);
+    return false;
+  }
+
+  t = &thread_workers[cpu];
+  if (!t->task || smp_load_acquire(&t->busy))
+    return false;
+
+  t->busy = true;
+  t->start_routine = start_routine;
+  t->arg = arg;
+  t->retval = NULL;
+  t->running = false;
+  t->go = false;
+  t->cancelled = false;
+  reinit_completion(&t->done);
+
+  WRITE_ONCE(t->pending, true);
+  wake_up(&t->wq);
+
+  // The worker may still be kept off its CPU, by something else spinning
+  // there. It is then cancelled and lets the slot go whenever it gets to run.
+  start = local_clock();
+  while (!smp_load_acquire(&t->running)) {
+    if (local_clock() - start > THREAD_START_TIMEOUT_NS) {
+      pr_err("thread: the worker on CPU %llu did not start\n", cpu);
+      WRITE_ONCE(t->cancelled, true);
+      smp_store_release(&t->go, true);
+      return false;
+    }
+    cpu_relax();
+  }
+  smp_store_release(&t->go, true);
+
+  *thread = t;
+  return true;
+}
+
+// The caller cannot sleep, so the completion is polled
+bool thread_join(thread_t thread, void **retval) {
+  if (!thread || !thread->busy)
+    return false;
+
+  while (!try_wait_for_completion(&thread->done))
+    cpu_relax();
+
+  if (retval)
+    *retval = thread->retval;
+
+  thread->busy = false;
+  return true;
+}
+
+static inline void thread_relax(void) { cpu_relax(); }
+
+// A CPU runs a single worker, nobody has to sleep
+static inline void thread_park(volatile u32 *addr, u32 val) {
+  (void)addr;
+  (void)val;
+  thread_relax();
+}
+
+static inline void thread_unpark(volatile u32 *addr) { (void)addr; }
+
 #else
 #ifdef RUNNER_USER
 
@@ -86,12 +340,171 @@ bool thread_join(thread_t thread, void **retval) {
   return err == 0;
 }
 
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+static inline void thread_relax(void) {
+#ifdef TARGET_X86_64
+  __builtin_ia32_pause();
+#endif
+}
+
+static void thread_barrier_wait(thread_barrier_t *b, u32 *local_sense,
+                                bool park, volatile bool *abort);
+
+static long thread_futex(volatile u32 *addr, int op, u32 val) {
+  return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
+
+// Sleeps while *addr is val
+static inline void thread_park(volatile u32 *addr, u32 val) {
+  thread_futex(addr, FUTEX_WAIT_PRIVATE, val);
+}
+
+static inline void thread_unpark(volatile u32 *addr) {
+  thread_futex(addr, FUTEX_WAKE_PRIVATE, INT_MAX);
+}
+
+// Workers sleep on the generation futex between runs, so the pool costs
+// nothing while the test is measuring something else
+static void *thread_pool_worker(void *varg) {
+  struct thread_pool_slot *slot = varg;
+  thread_pool_t *pool = slot->pool;
+  u32 seen = 0;
+
+  while (true) {
+    u32 gen;
+    while ((gen = __atomic_load_n(&pool->generation, __ATOMIC_ACQUIRE)) ==
+           seen)
+      thread_futex(&pool->generation, FUTEX_WAIT_PRIVATE, seen);
+    seen = gen;
+
+    if (__atomic_load_n(&pool->stopping, __ATOMIC_ACQUIRE))
+      break;
+    if (!(pool->active & (1u << slot->idx)))
+      continue;
+
+    thread_barrier_wait(&pool->start, &slot->sense, slot->park, &pool->abort);
+    slot->retval = pool->routine(pool->args[slot->idx]);
+
+    if (__atomic_add_fetch(&pool->done, 1, __ATOMIC_RELEASE) ==
+        pool->start.total)
+      thread_futex(&pool->done, FUTEX_WAKE_PRIVATE, 1);
+  }
+
+  return NULL;
+}
+
+static void thread_pool_init(thread_pool_t *pool, usize count,
+                             const usize cpus[]);
+static bool thread_pool_arm(thread_pool_t *pool, u32 active,
+                            void *(*routine)(void *), void *args[]);
+
+bool thread_pool_create(thread_pool_t *pool, usize count, const usize cpus[]) {
+  if (!pool || count == 0 || count > THREAD_POOL_MAX)
+    return false;
+
+  thread_pool_init(pool, count, cpus);
+
+  for (usize i = 0; i < count; i++) {
+    // Pinned before it ever runs, not from inside the thread
+    pthread_attr_t attr;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpus[i], &set);
+    pthread_attr_init(&attr);
+    pthread_attr_setaffinity_np(&attr, sizeof(set), &set);
+
+    struct thread_impl_t *t = malloc(sizeof(*t));
+    if (!t || pthread_create(&t->t, &attr, thread_pool_worker,
+                             &pool->slots[i]) != 0) {
+      pthread_attr_destroy(&attr);
+      free(t);
+      pool->count = i;
+      thread_pool_destroy(pool);
+      return false;
+    }
+
+    pthread_attr_destroy(&attr);
+    pool->workers[i] = t;
+  }
+
+  return true;
+}
+
+bool thread_pool_start_some(thread_pool_t *pool, u32 active,
+                            void *(*routine)(void *), void *args[]) {
+  if (!pool || pool->count == 0 ||
+      !thread_pool_arm(pool, active, routine, args))
+    return false;
+
+  __atomic_store_n(&pool->done, 0, __ATOMIC_RELAXED);
+
+  __atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+  thread_futex(&pool->generation, FUTEX_WAKE_PRIVATE, INT_MAX);
+  return true;
+}
+
+bool thread_pool_join(thread_pool_t *pool, void *retvals[]) {
+  if (!pool || pool->count == 0)
+    return false;
+
+  u32 done;
+  while ((done = __atomic_load_n(&pool->done, __ATOMIC_ACQUIRE)) !=
+         pool->start.total)
+    thread_futex(&pool->done, FUTEX_WAIT_PRIVATE, done);
+
+  for (usize i = 0; retvals && i < pool->count; i++) {
+    if (pool->active & (1u << i))
+      retvals[i] = pool->slots[i].retval;
+  }
+  return true;
+}
+
+void thread_pool_destroy(thread_pool_t *pool) {
+  if (!pool || pool->count == 0)
+    return;
+
+  __atomic_store_n(&pool->stopping, true, __ATOMIC_RELEASE);
+  __atomic_add_fetch(&pool->generation, 1, __ATOMIC_RELEASE);
+  thread_futex(&pool->generation, FUTEX_WAKE_PRIVATE, INT_MAX);
+
+  for (usize i = 0; i < pool->count; i++)
+    thread_join(pool->workers[i], NULL);
+  pool->count = 0;
+}
+
 #else
 #ifdef RUNNER_SIMULATION
 #include <stdatomic.h>
 
+// Both can be overridden from the compiler flags. The orchestrator defines
+// NUM_HARTS from its --harts option, which has to match the simulated config.
+#ifndef NUM_HARTS
 #define NUM_HARTS 4
+#endif
+
+// Power of two, it is also the capacity of every deque
+#ifndef MAX_THREADS
 #define MAX_THREADS 16
+#endif
+
+_Static_assert((MAX_THREADS & (MAX_THREADS - 1)) == 0,
+               "MAX_THREADS must be a power of two");
+
+// Only threads created with this hart can be stolen by an idle hart, every
+// other thread is pinned and only ever runs on its own hart
+#define THREAD_ANY_HART ((usize)-1)
+
+// Victims probed by an idle hart on every yeild()
+#ifndef STEAL_ATTEMPTS
+#define STEAL_ATTEMPTS NUM_HARTS
+#endif
+
+// Scheduler state of different harts never shares a line
+#define SCHED_LINE 64
 
 // ---------------------
 // Thread definitions
@@ -116,26 +529,32 @@ typedef thread_impl_t *thread_t;
 
 static thread_impl_t THREAD_POOL[MAX_THREADS];
 
+// Every hart owns:
+//   inbox   threads pinned to it by other harts, a lock-free stack
+//   pinned  its private FIFO of pinned threads, filled from the inbox
+//   deque   Chase-Lev deque of the stealable threads it created, the owner
+//           pushes and takes at the bottom, thieves steal from the top
 typedef struct {
-  thread_t head;
-  thread_t tail;
-  atomic_flag lock;
-} thread_queue_t;
+  thread_t inbox __attribute__((aligned(SCHED_LINE)));
+
+  thread_t pinned_head __attribute__((aligned(SCHED_LINE)));
+  thread_t pinned_tail;
 
-static thread_queue_t hart_queues[NUM_HARTS];
+  ssize top __attribute__((aligned(SCHED_LINE)));
+  ssize bottom __attribute__((aligned(SCHED_LINE)));
+  thread_t deque[MAX_THREADS];
+} hart_sched_t;
+
+static hart_sched_t hart_scheds[NUM_HARTS];
 
 volatile bool scheduler_running = true;
 
-// ---------------------
-// Spinlock helpers
-// ---------------------
-static inline void lock(atomic_flag *f) {
-  while (atomic_flag_test_and_set(f))
-    ; // spin
+static inline usize mhartid(void) {
+  usize id;
+  asm volatile("csrr %0, mhartid" : "=r"(id));
+  return id;
 }
 
-static inline void unlock(atomic_flag *f) { atomic_flag_clear(f); }
-
 // ---------------------
 // Pool management
 // ---------------------
@@ -143,8 +562,8 @@ static thread_t alloc_thread(void) {
   for (int i = 0; i < MAX_THREADS; i++) {
     thread_state_t expected = THREAD_UNUSED;
     if (__atomic_compare_exchange_n(&THREAD_POOL[i].state, &expected,
-                                    THREAD_READY, 0, __ATOMIC_SEQ_CST,
-                                    __ATOMIC_SEQ_CST)) {
+                                    THREAD_READY, 0, __ATOMIC_ACQ_REL,
+                                    __ATOMIC_RELAXED)) {
       THREAD_POOL[i].next = NULL;
       return &THREAD_POOL[i];
     }
@@ -154,47 +573,111 @@ static thread_t alloc_thread(void) {
 
 static void free_thread(thread_t t) {
   if (t) {
-    __atomic_store_n(&t->state, THREAD_UNUSED, __ATOMIC_SEQ_CST);
+    __atomic_store_n(&t->state, THREAD_UNUSED, __ATOMIC_RELEASE);
   }
 }
 
-static void enqueue_thread(usize hart, thread_t t) {
-  t->next = NULL;
-  thread_queue_t *q = &hart_queues[hart];
-  lock(&q->lock);
+// ---------------------
+// Pinned threads
+// ---------------------
+static void inbox_push(hart_sched_t *s, thread_t t) {
+  thread_t head = __atomic_load_n(&s->inbox, __ATOMIC_RELAXED);
+  do {
+    t->next = head;
+  } while (!__atomic_compare_exchange_n(&s->inbox, &head, t, 1,
+                                        __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
 
-  if (!q->tail) {
-    q->head = q->tail = t;
+static void pinned_append(hart_sched_t *s, thread_t t) {
+  t->next = NULL;
+  if (!s->pinned_tail) {
+    s->pinned_head = s->pinned_tail = t;
   } else {
-    q->tail->next = t;
-    q->tail = t;
+    s->pinned_tail->next = t;
+    s->pinned_tail = t;
   }
-
-  unlock(&q->lock);
 }
 
-static thread_t dequeue_thread(usize hart) {
-  thread_queue_t *q = &hart_queues[hart];
-  thread_t t = NULL;
+// Owner only
+static thread_t pinned_take(hart_sched_t *s) {
+  if (!s->pinned_head && __atomic_load_n(&s->inbox, __ATOMIC_RELAXED)) {
+    // The inbox is LIFO, reverse it to keep the creation order
+    thread_t t = __atomic_exchange_n(&s->inbox, NULL, __ATOMIC_ACQUIRE);
+    thread_t rev = NULL;
+    while (t) {
+      thread_t next = t->next;
+      t->next = rev;
+      rev = t;
+      t = next;
+    }
 
-  lock(&q->lock);
+    while (rev) {
+      thread_t next = rev->next;
+      pinned_append(s, rev);
+      rev = next;
+    }
+  }
 
-  t = q->head;
+  thread_t t = s->pinned_head;
   if (t) {
-    q->head = t->next;
-    if (!q->head)
-      q->tail = NULL;
+    s->pinned_head = t->next;
+    if (!s->pinned_head)
+      s->pinned_tail = NULL;
     t->next = NULL;
   }
-
-  unlock(&q->lock);
   return t;
 }
 
-static inline usize mhartid(void) {
-  usize id;
-  asm volatile("csrr %0, mhartid" : "=r"(id));
-  return id;
+// ---------------------
+// Chase-Lev deque
+// ---------------------
+
+// Owner only, it cannot overflow as there are at most MAX_THREADS threads
+static void deque_push(hart_sched_t *s, thread_t t) {
+  ssize b = __atomic_load_n(&s->bottom, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->deque[b & (MAX_THREADS - 1)], t, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  __atomic_store_n(&s->bottom, b + 1, __ATOMIC_RELAXED);
+}
+
+// Owner only
+static thread_t deque_take(hart_sched_t *s) {
+  ssize b = __atomic_load_n(&s->bottom, __ATOMIC_RELAXED) - 1;
+  __atomic_store_n(&s->bottom, b, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  ssize t = __atomic_load_n(&s->top, __ATOMIC_RELAXED);
+
+  if (t > b) {
+    __atomic_store_n(&s->bottom, b + 1, __ATOMIC_RELAXED);
+    return NULL;
+  }
+
+  thread_t x = __atomic_load_n(&s->deque[b & (MAX_THREADS - 1)],
+                               __ATOMIC_RELAXED);
+  if (t == b) {
+    // Last one, race against the thieves
+    if (!__atomic_compare_exchange_n(&s->top, &t, t + 1, 0, __ATOMIC_SEQ_CST,
+                                     __ATOMIC_RELAXED))
+      x = NULL;
+    __atomic_store_n(&s->bottom, b + 1, __ATOMIC_RELAXED);
+  }
+  return x;
+}
+
+static thread_t deque_steal(hart_sched_t *s) {
+  ssize t = __atomic_load_n(&s->top, __ATOMIC_ACQUIRE);
+  __atomic_thread_fence(__ATOMIC_SEQ_CST);
+  ssize b = __atomic_load_n(&s->bottom, __ATOMIC_ACQUIRE);
+
+  if (t >= b)
+    return NULL;
+
+  thread_t x = __atomic_load_n(&s->deque[t & (MAX_THREADS - 1)],
+                               __ATOMIC_RELAXED);
+  if (!__atomic_compare_exchange_n(&s->top, &t, t + 1, 0, __ATOMIC_SEQ_CST,
+                                   __ATOMIC_RELAXED))
+    return NULL; // Lost the race, do not retry here
+  return x;
 }
 
 // ---------------------
@@ -202,7 +685,7 @@ static inline usize mhartid(void) {
 // ---------------------
 bool thread_create(thread_t *thread, void *(*entry)(void *), void *arg,
                    usize hart) {
-  if (!thread || !entry || hart >= NUM_HARTS)
+  if (!thread || !entry || (hart >= NUM_HARTS && hart != THREAD_ANY_HART))
     return false;
 
   thread_t t = alloc_thread();
@@ -214,7 +697,14 @@ bool thread_create(thread_t *thread, void *(*entry)(void *), void *arg,
   t->retval = NULL;
   t->requested_hart = hart;
 
-  enqueue_thread(hart, t);
+  usize h = mhartid();
+  if (hart == THREAD_ANY_HART)
+    deque_push(&hart_scheds[h], t);
+  else if (hart == h)
+    pinned_append(&hart_scheds[h], t);
+  else
+    inbox_push(&hart_scheds[hart], t);
+
   *thread = t;
   return true;
 }
@@ -224,7 +714,7 @@ bool thread_join(thread_t t, void **retval) {
   if (!t)
     return false;
 
-  while (t->state != THREAD_FINISHED) {
+  while (__atomic_load_n(&t->state, __ATOMIC_ACQUIRE) != THREAD_FINISHED) {
     yeild();
   }
 
@@ -236,26 +726,17 @@ bool thread_join(thread_t t, void **retval) {
 }
 
 // ---------------------
-// Fallback stealing
+// Bounded stealing
 // ---------------------
-static thread_t steal_any_thread(void) {
-  usize h = mhartid();
-
-  for (usize i = 0; i < NUM_HARTS; i++) {
-    if (i == h)
-      continue;
-
-    thread_t t = dequeue_thread(i);
-    if (!t)
+static thread_t steal_any_thread(usize h) {
+  for (usize i = 1; i <= STEAL_ATTEMPTS; i++) {
+    usize victim = (h + i) % NUM_HARTS;
+    if (victim == h)
       continue;
 
-    thread_state_t expected = THREAD_READY;
-    if (__atomic_compare_exchange_n(&t->state, &expected, THREAD_RUNNING, 0,
-                                    __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST)) {
+    thread_t t = deque_steal(&hart_scheds[victim]);
+    if (t)
       return t;
-    } else {
-      enqueue_thread(i, t);
-    }
   }
 
   return NULL;
@@ -266,19 +747,18 @@ static thread_t steal_any_thread(void) {
 // ---------------------
 void yeild(void) {
   usize h = mhartid();
-  thread_t t = dequeue_thread(h);
+  hart_sched_t *s = &hart_scheds[h];
 
-  if (!t) {
-    t = steal_any_thread();
-  }
+  thread_t t = pinned_take(s);
+  if (!t)
+    t = deque_take(s);
+  if (!t)
+    t = steal_any_thread(h);
 
   if (t) {
-    if (t->requested_hart == h || t->state == THREAD_RUNNING) {
-      t->retval = t->entry(t->arg);
-      __atomic_store_n(&t->state, THREAD_FINISHED, __ATOMIC_SEQ_CST);
-    } else {
-      enqueue_thread(t->requested_hart, t);
-    }
+    __atomic_store_n(&t->state, THREAD_RUNNING, __ATOMIC_RELAXED);
+    t->retval = t->entry(t->arg);
+    __atomic_store_n(&t->state, THREAD_FINISHED, __ATOMIC_RELEASE);
   }
 }
 
@@ -288,10 +768,177 @@ void hart_scheduler_loop(void) {
   }
 }
 
+// Threads of the same hart only run when someone yields
+static inline void thread_relax(void) { yeild(); }
+
+// Yielding already lets the other threads of the hart run
+static inline void thread_park(volatile u32 *addr, u32 val) {
+  (void)addr;
+  (void)val;
+  thread_relax();
+}
+
+static inline void thread_unpark(volatile u32 *addr) { (void)addr; }
+
 #else
 #error Unsupported target
 #endif
 #endif
 #endif
 
+// ---------------------
+// Shared pool code
+// ---------------------
+static void thread_barrier_wait(thread_barrier_t *b, u32 *local_sense,
+                                bool park, volatile bool *abort) {
+  u32 sense = *local_sense ^ 1;
+  *local_sense = sense;
+
+  if (__atomic_add_fetch(&b->count, 1, __ATOMIC_ACQ_REL) == b->total) {
+    __atomic_store_n(&b->count, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&b->sense, sense, __ATOMIC_SEQ_CST);
+    if (__atomic_load_n(&b->parked, __ATOMIC_SEQ_CST))
+      thread_unpark(&b->sense);
+    return;
+  }
+
+  // A spinning waiter would hold the CPU the others of the run need to arrive
+  if (park) {
+    __atomic_add_fetch(&b->parked, 1, __ATOMIC_SEQ_CST);
+    while (__atomic_load_n(&b->sense, __ATOMIC_ACQUIRE) != sense &&
+           !__atomic_load_n(abort, __ATOMIC_ACQUIRE))
+      thread_park(&b->sense, sense ^ 1);
+    __atomic_sub_fetch(&b->parked, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  while (__atomic_load_n(&b->sense, __ATOMIC_ACQUIRE) != sense &&
+         !__atomic_load_n(abort, __ATOMIC_ACQUIRE))
+    thread_relax();
+}
+
+static void thread_pool_init(thread_pool_t *pool, usize count,
+                             const usize cpus[]) {
+  *pool = (thread_pool_t){0};
+  pool->count = count;
+  pool->start.total = count;
+
+  for (usize i = 0; i < count; i++) {
+    pool->cpus[i] = cpus[i];
+    pool->slots[i] = (struct thread_pool_slot){.pool = pool, .idx = i};
+  }
+}
+
+// Sets up the start barrier for the workers in `active`. The others skipped
+// the previous runs, their sense is realigned with the barrier.
+static bool thread_pool_arm(thread_pool_t *pool, u32 active,
+                            void *(*routine)(void *), void *args[]) {
+  if (active == 0 || (active >> pool->count) != 0)
+    return false;
+
+  pool->routine = routine;
+  pool->active = active;
+  pool->start.total = __builtin_popcount(active);
+
+  for (usize i = 0; i < pool->count; i++) {
+    struct thread_pool_slot *slot = &pool->slots[i];
+
+    pool->args[i] = args ? args[i] : NULL;
+    slot->sense = pool->start.sense;
+    slot->park = false;
+    for (usize j = 0; j < pool->count; j++) {
+      if (j != i && (active & (1u << j)) && pool->cpus[j] == pool->cpus[i])
+        slot->park = true;
+    }
+  }
+
+  return true;
+}
+
+bool thread_pool_start(thread_pool_t *pool, void *(*routine)(void *),
+                       void *args[]) {
+  if (!pool)
+    return false;
+
+  return thread_pool_start_some(pool, (1u << pool->count) - 1, routine, args);
+}
+
+#ifndef RUNNER_USER
+
+// The runners without a native pool start one thread per worker on every
+// run, their threads are already persistent: pinned kthreads in the kernel
+// and the per-hart schedulers in simulation
+static void *thread_pool_trampoline(void *arg) {
+  struct thread_pool_slot *slot = arg;
+  thread_pool_t *pool = slot->pool;
+
+  thread_barrier_wait(&pool->start, &slot->sense, slot->park, &pool->abort);
+  if (pool->abort)
+    return NULL;
+
+  return pool->routine(pool->args[slot->idx]);
+}
+
+bool thread_pool_create(thread_pool_t *pool, usize count, const usize cpus[]) {
+  if (!pool || count == 0 || count > THREAD_POOL_MAX)
+    return false;
+
+  thread_pool_init(pool, count, cpus);
+  return true;
+}
+
+bool thread_pool_start_some(thread_pool_t *pool, u32 active,
+                            void *(*routine)(void *), void *args[]) {
+  if (!pool || pool->count == 0 ||
+      !thread_pool_arm(pool, active, routine, args))
+    return false;
+
+  pool->abort = false;
+  for (usize i = 0; i < pool->count; i++)
+    pool->workers[i] = NULL;
+
+  for (usize i = 0; i < pool->count; i++) {
+    if (!(active & (1u << i)))
+      continue;
+
+    if (!thread_create(&pool->workers[i], thread_pool_trampoline,
+                       &pool->slots[i], pool->cpus[i])) {
+      // Let the ones already waiting go without running the routine
+      __atomic_store_n(&pool->abort, true, __ATOMIC_RELEASE);
+      thread_pool_join(pool, NULL);
+
+      // The barrier never completed, the next run realigns the senses
+      pool->start.count = 0;
+      return false;
+    }
+  }
+
+  return true;
+}
+
+// Joins the workers started by the last run
+bool thread_pool_join(thread_pool_t *pool, void *retvals[]) {
+  if (!pool || pool->count == 0)
+    return false;
+
+  for (usize i = 0; i < pool->count; i++) {
+    if (!pool->workers[i])
+      continue;
+
+    void *ret = NULL;
+    thread_join(pool->workers[i], &ret);
+    pool->workers[i] = NULL;
+    if (retvals)
+      retvals[i] = ret;
+  }
+  return !pool->abort;
+}
+
+void thread_pool_destroy(thread_pool_t *pool) {
+  if (pool)
+    pool->count = 0;
+}
+
+#endif
+
 #endif
@@ -0,0 +1,393 @@
+#ifndef _TOPOLOGY
+#define _TOPOLOGY
+
+#include "types.h"
+
+// CPU placement queries for the multi threaded tests, so they stop assuming
+// that CPU 1 is the SMT sibling of CPU 0 and CPU 2 another core. Every query
+// returns TOPOLOGY_NONE when there is no CPU with that relation.
+
+#define TOPOLOGY_NONE ((usize)-1)
+
+// What a test records about the CPUs it picked, all ids are ~0 for
+// TOPOLOGY_NONE
+typedef struct {
+  u32 cpu;
+  u32 core;
+  u32 cluster;
+  u32 package;
+} topology_cpu_t;
+
+usize topology_current_cpu(void);
+
+// Another hardware thread of the same core
+usize sibling_of(usize cpu);
+
+// A CPU of another core in the same package
+usize other_core_same_package(usize cpu);
+
+// Writes up to `max` CPUs sharing the last level cache with `cpu`, `cpu`
+// itself excluded, returns how many were written
+usize cpus_sharing_llc(usize cpu, usize out[], usize max);
+
+bool topology_describe(usize cpu, topology_cpu_t *desc);
+
+// Where to run a thread that has to share the core's buffers with `cpu`: the
+// SMT sibling, else another core of the package. Never `cpu` itself.
+static inline usize companion_of(usize cpu) {
+  const usize c = sibling_of(cpu);
+  return c != TOPOLOGY_NONE ? c : other_core_same_package(cpu);
+}
+
+#endif // _TOPOLOGY
+
+#if defined(_TOPOLOGY_IMPLEMENTATION) && !defined(_TOPOLOGY_IMPLEMENTED)
+#define _TOPOLOGY_IMPLEMENTED
+#ifdef RUNNER_KERNEL
+
+#include <linux/cpumask.h>
+#include <linux/smp.h>
+#include <linux/topology.h>
+
+// Everything is already in the kernel cpumasks, they can be read with IRQs
+// disabled so the queries work from inside the test
+
+usize topology_current_cpu(void) { return smp_processor_id(); }
+
+usize sibling_of(usize cpu) {
+  unsigned int c;
+
+  if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+    return TOPOLOGY_NONE;
+
+  for_each_cpu(c, topology_sibling_cpumask(cpu)) {
+    if (c != cpu && cpu_online(c))
+      return c;
+  }
+
+  return TOPOLOGY_NONE;
+}
+
+usize other_core_same_package(usize cpu) {
+  unsigned int c;
+
+  if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+    return TOPOLOGY_NONE;
+
+  for_each_cpu(c, topology_core_cpumask(cpu)) {
+    if (cpu_online(c) && !cpumask_test_cpu(c, topology_sibling_cpumask(cpu)))
+      return c;
+  }
+
+  return TOPOLOGY_NONE;
+}
+
+usize cpus_sharing_llc(usize cpu, usize out[], usize max) {
+  unsigned int c;
+  usize n = 0;
+
+  if (cpu >= nr_cpu_ids || !cpu_online(cpu))
+    return 0;
+
+#ifdef TARGET_X86_64
+  const struct cpumask *llc = cpu_llc_shared_mask(cpu);
+#else
+  // No generic LLC mask, the package is the closest approximation
+  const struct cpumask *llc = topology_core_cpumask(cpu);
+#endif
+
+  for_each_cpu(c, llc) {
+    if (n == max)
+      break;
+    if (c != cpu && cpu_online(c))
+      out[n++] = c;
+  }
+
+  return n;
+}
+
+bool topology_describe(usize cpu, topology_cpu_t *desc) {
+  if (cpu >= nr_cpu_ids || !cpu_online(cpu)) {
+    *desc = (topology_cpu_t){~0u, ~0u, ~0u, ~0u};
+    return false;
+  }
+
+  desc->cpu = cpu;
+  desc->core = topology_core_id(cpu);
+  desc->cluster = topology_cluster_id(cpu);
+  desc->package = topology_physical_package_id(cpu);
+  return true;
+}
+
+#else
+#ifdef RUNNER_USER
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Read once from /sys/devices/system/cpu on the first query. The ids of the
+// LLC are the lowest CPU in its shared_cpu_list, the ones of the physical
+// core the lowest in its core_cpus_list: core_id is only unique within a die
+// and several dies can share a package.
+
+#define TOPOLOGY_SYSFS "/sys/devices/system/cpu"
+
+// user_exe_tester.c drops _GNU_SOURCE before sched.h is first included
+int sched_getcpu(void);
+
+struct topology_entry {
+  bool online;
+  u32 core;
+  u32 cluster;
+  u32 package;
+  u32 smt; // Lowest CPU of the same core
+  u32 llc;
+  u32 llc_level;
+};
+
+// Sized from the possible CPUs, when they can't be read the first
+// TOPOLOGY_FALLBACK_CPUS are probed
+#define TOPOLOGY_FALLBACK_CPUS 256
+
+static struct topology_entry *topology = 0;
+static usize topology_count = 0;
+static bool topology_loaded = false;
+
+static bool topology_read_u32(const char *path, u32 *out) {
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return false;
+
+  bool ok = fscanf(f, "%u", out) == 1;
+  fclose(f);
+  return ok;
+}
+
+// Highest possible CPU + 1, the last id of a cpu list such as "0-511"
+static usize topology_possible(void) {
+  char line[256];
+
+  FILE *f = fopen(TOPOLOGY_SYSFS "/possible", "r");
+  if (!f)
+    return TOPOLOGY_FALLBACK_CPUS;
+
+  const bool ok = fgets(line, sizeof(line), f) != 0;
+  fclose(f);
+  if (!ok)
+    return TOPOLOGY_FALLBACK_CPUS;
+
+  const char *last = line;
+  for (const char *p = line; *p; p++) {
+    if (*p == '-' || *p == ',')
+      last = p + 1;
+  }
+
+  return strtoul(last, 0, 10) + 1;
+}
+
+static void topology_load(void) {
+  char path[128];
+
+  topology_loaded = true;
+  const usize possible = topology_possible();
+  topology = calloc(possible, sizeof(*topology));
+  if (!topology)
+    return;
+
+  for (usize cpu = 0; cpu < possible; cpu++) {
+    struct topology_entry *e = &topology[cpu];
+
+    snprintf(path, sizeof(path), TOPOLOGY_SYSFS "/cpu%zu/topology/core_id",
+             (size_t)cpu);
+    if (!topology_read_u32(path, &e->core))
+      continue; // Missing or offline
+
+    topology_count = cpu + 1;
+    e->online = true;
+
+    snprintf(path, sizeof(path),
+             TOPOLOGY_SYSFS "/cpu%zu/topology/physical_package_id",
+             (size_t)cpu);
+    if (!topology_read_u32(path, &e->package))
+      e->package = 0;
+
+    // Not exposed before 5.16 or on machines without clusters
+    snprintf(path, sizeof(path), TOPOLOGY_SYSFS "/cpu%zu/topology/cluster_id",
+             (size_t)cpu);
+    if (!topology_read_u32(path, &e->cluster))
+      e->cluster = e->core;
+
+    // A cpu list, core_cpus_list replaced thread_siblings_list in 5.5
+    snprintf(path, sizeof(path),
+             TOPOLOGY_SYSFS "/cpu%zu/topology/core_cpus_list", (size_t)cpu);
+    if (!topology_read_u32(path, &e->smt)) {
+      snprintf(path, sizeof(path),
+               TOPOLOGY_SYSFS "/cpu%zu/topology/thread_siblings_list",
+               (size_t)cpu);
+      if (!topology_read_u32(path, &e->smt))
+        e->smt = cpu;
+    }
+
+    e->llc = e->package;
+    e->llc_level = 0;
+    for (usize idx = 0;; idx++) {
+      u32 level, first;
+
+      snprintf(path, sizeof(path), TOPOLOGY_SYSFS "/cpu%zu/cache/index%zu/level",
+               (size_t)cpu, (size_t)idx);
+      if (!topology_read_u32(path, &level))
+        break;
+
+      snprintf(path, sizeof(path),
+               TOPOLOGY_SYSFS "/cpu%zu/cache/index%zu/shared_cpu_list",
+               (size_t)cpu, (size_t)idx);
+      // A cpu list such as "0-3,8-11", only its first CPU is read
+      if (level >= e->llc_level && topology_read_u32(path, &first)) {
+        e->llc_level = level;
+        e->llc = first;
+      }
+    }
+  }
+}
+
+static struct topology_entry *topology_get(usize cpu) {
+  if (!topology_loaded)
+    topology_load();
+
+  if (cpu >= topology_count || !topology[cpu].online)
+    return (void *)0;
+
+  return &topology[cpu];
+}
+
+usize topology_current_cpu(void) {
+  int cpu = sched_getcpu();
+  return cpu < 0 ? TOPOLOGY_NONE : (usize)cpu;
+}
+
+usize sibling_of(usize cpu) {
+  struct topology_entry *e = topology_get(cpu);
+  if (!e)
+    return TOPOLOGY_NONE;
+
+  for (usize c = 0; c < topology_count; c++) {
+    struct topology_entry *o = &topology[c];
+    if (c != cpu && o->online && o->smt == e->smt)
+      return c;
+  }
+
+  return TOPOLOGY_NONE;
+}
+
+usize other_core_same_package(usize cpu) {
+  struct topology_entry *e = topology_get(cpu);
+  if (!e)
+    return TOPOLOGY_NONE;
+
+  // Prefer a core of the same cluster, it is the closest one
+  usize found = TOPOLOGY_NONE;
+  for (usize c = 0; c < topology_count; c++) {
+    struct topology_entry *o = &topology[c];
+    if (!o->online || o->package != e->package || o->smt == e->smt)
+      continue;
+
+    if (o->cluster == e->cluster)
+      return c;
+    if (found == TOPOLOGY_NONE)
+      found = c;
+  }
+
+  return found;
+}
+
+usize cpus_sharing_llc(usize cpu, usize out[], usize max) {
+  struct topology_entry *e = topology_get(cpu);
+  if (!e)
+    return 0;
+
+  usize n = 0;
+  for (usize c = 0; c < topology_count && n < max; c++) {
+    struct topology_entry *o = &topology[c];
+    if (c != cpu && o->online && o->llc == e->llc)
+      out[n++] = c;
+  }
+
+  return n;
+}
+
+bool topology_describe(usize cpu, topology_cpu_t *desc) {
+  struct topology_entry *e = topology_get(cpu);
+  if (!e) {
+    *desc = (topology_cpu_t){~0u, ~0u, ~0u, ~0u};
+    return false;
+  }
+
+  desc->cpu = cpu;
+  desc->core = e->core;
+  desc->cluster = e->cluster;
+  desc->package = e->package;
+  return true;
+}
+
+#else
+#ifdef RUNNER_SIMULATION
+
+// Every hart is a core of its own in a single package, all sharing the LLC.
+// NUM_HARTS has the same default as in thread.h.
+#ifndef NUM_HARTS
+#define NUM_HARTS 4
+#endif
+
+usize topology_current_cpu(void) {
+  usize id;
+  __asm__ __volatile__("csrr %0, mhartid" : "=r"(id));
+  return id;
+}
+
+usize sibling_of(usize cpu) {
+  (void)cpu;
+  return TOPOLOGY_NONE;
+}
+
+usize other_core_same_package(usize cpu) {
+  if (cpu >= NUM_HARTS || NUM_HARTS < 2)
+    return TOPOLOGY_NONE;
+
+  return (cpu + 1) % NUM_HARTS;
+}
+
+usize cpus_sharing_llc(usize cpu, usize out[], usize max) {
+  usize n = 0;
+  if (cpu >= NUM_HARTS)
+    return 0;
+
+  for (usize c = 0; c < NUM_HARTS && n < max; c++) {
+    if (c != cpu)
+      out[n++] = c;
+  }
+
+  return n;
+}
+
+bool topology_describe(usize cpu, topology_cpu_t *desc) {
+  if (cpu >= NUM_HARTS) {
+    *desc = (topology_cpu_t){~0u, ~0u, ~0u, ~0u};
+    return false;
+  }
+
+  desc->cpu = cpu;
+  desc->core = cpu;
+  desc->cluster = 0;
+  desc->package = 0;
+  return true;
+}
+
+#else
+#error Unsupported runner
+#endif
+#endif
+#endif
+
+#endif // _TOPOLOGY_IMPLEMENTATION
@@ -217,6 +217,9 @@ typedef struct {
   fd fdin;
   fd fdout;
   fd fderr;
+  // The child leads its own process group, kill(-pid) reaches everything it
+  // starts
+  bool new_group;
 } redirect_t;
 
 #define NEW_READ_PIPE -3
@@ -242,7 +245,8 @@ bool __cmd_run_reset(cmd_t *cmd, redirect_t r);
 bool cmd_wait(cmd_t *cmd);
 bool cmd_wait_reset(cmd_t *cmd);
 
-#define cmd_run_async(cmd, ...) __cmd_run(cmd, ((redirect_t){__VA_ARGS__}))
+#define cmd_run_async(cmd, ...)                                                \
+  __cmd_run_async(cmd, ((redirect_t){__VA_ARGS__}))
 bool __cmd_run_async(cmd_t *cmd, redirect_t r);
 
 #define cmd_wait_all(...)                                                      \
@@ -318,6 +322,7 @@ s32 detect_jump_welch(s32 n, const double data[n], s32 window,
                       double threshold);
 ssize jump_welch_rel(s32 n, const double data[n], s32 window, double percent);
 double sqrt_d(double x);
+double coefficient_of_variation(s32 n, const double data[n]);
 
 #ifdef IMPLEMENTATIONS
 // ---------------------------------------------------------
@@ -605,12 +610,16 @@ bool __cmd_run_async(cmd_t *c, redirect_t r) {
   open_if_requested(c->fderr, pipefd[STDERR_FILENO]);
 
   pid_t cpid = fork();
+  c->pid = cpid;
   if (cpid < 0) {
     plog(ERR, "Could not fork child process: %s", strerror(errno));
-    return -1;
+    return false;
   }
 
   if (cpid == CHILD_PID) {
+    if (r.new_group)
+      setpgid(0, 0);
+
     child_write_pipe(&c->fdin, pipefd[STDIN_FILENO], STDIN_FILENO);
     child_read_pipe(&c->fdout, pipefd[STDOUT_FILENO], STDOUT_FILENO);
     child_read_pipe(&c->fderr, pipefd[STDERR_FILENO], STDERR_FILENO);
@@ -627,11 +636,15 @@ bool __cmd_run_async(cmd_t *c, redirect_t r) {
     unreachable("run async redirect");
   }
 
+  // Also from the parent, so the group exists before anyone signals it
+  if (r.new_group)
+    setpgid(cpid, cpid);
+
   parent_write_pipe(&c->fdin, pipefd[STDIN_FILENO]);
   parent_read_pipe(&c->fdout, pipefd[STDOUT_FILENO]);
   parent_read_pipe(&c->fderr, pipefd[STDERR_FILENO]);
 
-  return cpid;
+  return true;
 }
 
 bool __cmd_wait_all(int n, cmd_t waiters[static n]) {
@@ -1110,6 +1123,22 @@ double sqrt_d(double x) {
   return guess;
 }
 
+// Standard deviation over the mean, 0 when the mean is 0
+double coefficient_of_variation(s32 n, const double data[n]) {
+  if (n < 2)
+    return 0.0;
+
+  const double m = mean(data, 0, n);
+  if (m == 0.0)
+    return 0.0;
+
+  double var = 0.0;
+  for (s32 i = 0; i < n; i++)
+    var += (data[i] - m) * (data[i] - m);
+
+  return sqrt_d(var / (n - 1)) / fabs(m);
+}
+
 static double welch_df(double varL, double varR, int n) {
   double a = varL / n;
   double b = varR / n;
@@ -5,17 +5,23 @@
 #include "../../libs/lbstd.h"
 
 EXPORT_RESULT_SETUP(request_dependencies_t *dep) {
-  usize *tries = dep[0];
-  *tries /= 100000;
-  printf("%d\n", *tries);
+  // Scales with the calibrated core clock
+  calibration_t *calibration = dep[0];
+  calibration->budget /= 100000;
+  printf("%llu\n", calibration->budget);
 
   return OK;
 }
 
 EXPORT_RESULT_STRUCT_SIZE() { return sizeof(cache_result_t); }
 
+// Minimum gap between the cached and the uncached timings
+#define CACHE_EPSILON 0.2
+
+// A gap closer than this to CACHE_EPSILON flips the verdict with the noise
+#define CACHE_QUALITY_MARGIN 0.1
+
 EXPORT_RESULT_STRUCT_DIAGNOSTICS(cache_result_t *result) {
-  const double epsilon = 0.2;
 
   // We give  alittle bit of leeway since this result can be very noisy
   result->overhead = ((double)result->overhead_tot / result->tries) * 0.97f;
@@ -26,15 +32,36 @@ EXPORT_RESULT_STRUCT_DIAGNOSTICS(cache_result_t *result) {
       (double)result->uncached_access_time_tot / result->tries -
       result->overhead;
 
-  plog(INFO, "tries: %zu", result->tries);
+  // Same timings in core cycles, the fields above stay in counter ticks
+  // since the dependents compare them with their own readings
+  const double tsc_per_core =
+      result->tsc_per_core ? (double)result->tsc_per_core / FP_SCALE : 1.0;
+  result->cached_access_core_cycles =
+      result->cached_access_time / tsc_per_core;
+  result->uncached_access_core_cycles =
+      result->uncached_access_time / tsc_per_core;
+
+  plog(INFO, "tries: %zu, rejected samples: %llu", result->tries,
+       result->rejected_samples);
   plog(INFO, "overhead: %f", result->overhead);
   plog(INFO, "cached_access_time: %f", result->cached_access_time);
   plog(INFO, "uncached_access_time: %f", result->uncached_access_time);
+  plog(INFO, "core cycles: cached %f, uncached %f",
+       result->cached_access_core_cycles, result->uncached_access_core_cycles);
 
   if (result->cached_access_time <
-      result->uncached_access_time * (1 - epsilon)) {
+      result->uncached_access_time * (1 - CACHE_EPSILON)) {
     return OK;
   } else {
     return KO;
   }
 }
+
+EXPORT_RESULT_QUALITY(cache_result_t *result, double *quality) {
+  // Relative gap between the two timing clusters
+  *quality = result->uncached_access_time > 0
+                 ? 1 - result->cached_access_time / result->uncached_access_time
+                 : 0;
+
+  return fabs(*quality - CACHE_EPSILON) >= CACHE_QUALITY_MARGIN;
+}
@@ -11,10 +11,15 @@ typedef struct {
   u64 overhead_tot;
   u64 cached_access_time_tot;
   u64 uncached_access_time_tot;
+  u64 rejected_samples; // Contaminated and taken again
 
   double overhead;
   double cached_access_time;
   double uncached_access_time;
+
+  fix64 tsc_per_core;
+  double cached_access_core_cycles;
+  double uncached_access_core_cycles;
 } cache_result_t;
 
 #endif
@@ -29,19 +29,31 @@ AS_RESULT(cache_result_t);
   load5(x)
 
 void func(request_dependencies_t *args) {
-  RESULT->tries = *((usize *)args[0]);
+  const calibration_t *calibration = args[0];
+  RESULT->tries = calibration->budget;
+  RESULT->tsc_per_core = calibration->tsc_per_core;
+  RESULT->rejected_samples = 0;
   /* printf("%d\n", RESULT->tries); */
 
   volatile u8 CACHE_LINE_ALIGNED arr[CACHE_LINE_SZ] = {0};
 
+  // Samples hit by an interrupt or a migration are taken again, everything
+  // depending on the cache timings inherits clean numbers
+  sample_t smp = {0};
+  u64 delta;
+
   u64 sum = 0;
   for (int i = 0; i < RESULT->tries; i++) {
-    serialise();
-    memory_barrier();
-    volatile u64 start = get_cycle();
-    serialise();
-    read_memory_barrier();
-    sum += (get_cycle() - start);
+    do {
+      sample_begin(&smp);
+      serialise();
+      memory_barrier();
+      volatile u64 start = get_cycle();
+      serialise();
+      read_memory_barrier();
+      delta = get_cycle() - start;
+    } while (sample_rejected(&smp, delta, &RESULT->rejected_samples));
+    sum += delta;
 
     /* if (i % 10 == 0) { */
     /* printf("%d\n", i); */
@@ -55,23 +67,27 @@ void func(request_dependencies_t *args) {
 
   sum = 0;
   for (int i = 0; i < RESULT->tries; i++) {
-    serialise();
-    memory_barrier();
+    do {
+      sample_begin(&smp);
+      serialise();
+      memory_barrier();
 
 #ifdef MITIGATE
-    /* printf("HELLO\n"); */
-    cache_line_flush(arr);
-    serialise();
-    memory_barrier();
+      /* printf("HELLO\n"); */
+      cache_line_flush(arr);
+      serialise();
+      memory_barrier();
 #endif
 
-    volatile u64 start = get_cycle();
+      volatile u64 start = get_cycle();
 
-    load(arr);
+      load(arr);
 
-    serialise();
-    read_memory_barrier();
-    sum += (get_cycle() - start);
+      serialise();
+      read_memory_barrier();
+      delta = get_cycle() - start;
+    } while (sample_rejected(&smp, delta, &RESULT->rejected_samples));
+    sum += delta;
     /* if (i % 10 == 0) { */
     /* printf("%d\n", i); */
     /* } */
@@ -81,16 +97,20 @@ void func(request_dependencies_t *args) {
 
   sum = 0;
   for (int i = 0; i < RESULT->tries; i++) {
-    cache_line_flush(arr);
-    serialise();
-    memory_barrier();
-    volatile u64 start = get_cycle();
-
-    load(arr);
-
-    serialise();
-    read_memory_barrier();
-    sum += (get_cycle() - start);
+    do {
+      sample_begin(&smp);
+      cache_line_flush(arr);
+      serialise();
+      memory_barrier();
+      volatile u64 start = get_cycle();
+
+      load(arr);
+
+      serialise();
+      read_memory_barrier();
+      delta = get_cycle() - start;
+    } while (sample_rejected(&smp, delta, &RESULT->rejected_samples));
+    sum += delta;
     /* if (i % 10 == 0) { */
     /* printf("%d\n", i); */
     /* } */
@@ -12,6 +12,33 @@ typedef void request_return_t;
 typedef void (*testing_func_t)(request_dependencies_t *);
 typedef int cpuid_t;
 
+// args[0] of every test, measured by the orchestrator before the run. The
+// cycle counters of the tests tick at tsc_hz on x86, calibration_core_cycles()
+// turns them into core cycles.
+#define CALIBRATION_NONE 0  // Nothing measured, defaults
+#define CALIBRATION_FIXED 1 // Given with --clock-speed, or a simulation
+#define CALIBRATION_TSC 2   // TSC only, the core runs at the TSC rate
+#define CALIBRATION_PERF 3  // Core cycles from a perf counter
+#define CALIBRATION_MSR 4   // Core cycles from APERF/MPERF
+
+#define CALIBRATION_DEFAULT_HZ 100000000ULL
+
+typedef struct {
+  u64 budget; // Work budget of the test, managers may rescale it in setup
+  u64 tsc_hz;
+  u64 core_hz;        // Under load, after the turbo settled
+  fix64 tsc_per_core; // TSC ticks per core cycle
+  u32 source;
+  u32 seed; // Run seed, every module derives its streams from it (rand.h)
+} calibration_t;
+
+static inline u64 calibration_core_cycles(const calibration_t *c, u64 ticks) {
+  if (!c->tsc_per_core)
+    return ticks;
+
+  return (ticks << FP_SHIFT) / c->tsc_per_core;
+}
+
 struct run_function_request {
   unsigned long args_count;
   request_dependencies_t *args;
@@ -66,6 +66,11 @@ struct node_t *insertAtEnd(struct node_t **head,
 // LAP definitely can't reach it with the 255B stride limit.
 // Also, for more certainty in our signal, access different page offsets.
 #define NUM_PAGES_OTH 10
+
+// Every node of the list takes a page of its own
+#define KERNEL_ARENA_SZ                                                        \
+  (KERNEL_ARENA_DEFAULT_SZ + LL_SIZE * CACHE_LINE_SZ +                         \
+   (NUM_PAGES_BUF + NUM_PAGES_OTH) * PAGE_SZ)
 #define DUMMY_OFFSET 0x3210
 #define SECRET_OFFSET 0x1234
 
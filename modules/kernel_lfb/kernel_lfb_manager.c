@@ -11,6 +11,9 @@ EXPORT_RESULT_STRUCT_SIZE() { return sizeof(kernel_lfb_result_t); }
 
 EXPORT_RESULT_STRUCT_DIAGNOSTICS(kernel_lfb_result_t *result) {
   plog(INFO, "kernel_lfb module called!");
+  plog(INFO, "victim on cpu %u, producer on cpu %u (core %u, package %u)",
+       result->victim.cpu, result->producer.cpu, result->producer.core,
+       result->producer.package);
   double cache_line_access_time = (double)result->cache_line_time_access_tot /
                                       result->cache_line_access_count -
                                   result->overhead;
@@ -14,6 +14,10 @@ EXPORT_RESULT_STRUCT_DIAGNOSTICS(kernel_misprediction_result_t *result) {
                                   result->overhead;
   plog(INFO, "THIS cache_line_access_time %f", cache_line_access_time);
   plog(INFO, "uncached_access_time %f", result->uncached_access_time);
+  plog(INFO, "kernel uncached min %llu median %llu",
+       result->kernel_uncached_min, result->kernel_uncached_median);
+  plog(INFO, "kernel cached min %llu median %llu", result->kernel_cached_min,
+       result->kernel_cached_median);
   bool present =
       !are_close(cache_line_access_time, result->uncached_access_time, 20.f) &&
       cache_line_access_time < result->uncached_access_time;
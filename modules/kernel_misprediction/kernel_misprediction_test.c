@@ -50,6 +50,23 @@ void func(request_dependencies_t *args) {
   volatile usize *ptr = user_cache_line;
 
   volatile u8 *always_out_of_cache = (volatile u8 *)alloc(CACHE_LINE_SZ);
+
+  struct probe_measure *baseline = alloc(sizeof(struct probe_measure));
+  baseline->mode = PROBE_MEASURE_FLUSH_RELOAD;
+  baseline->iterations = tries;
+  baseline->bucket_width = 1;
+  if (kernel_ptr_measure(baseline)) {
+    RESULT->kernel_uncached_min = baseline->min;
+    RESULT->kernel_uncached_median = baseline->median;
+  }
+
+  baseline->mode = PROBE_MEASURE_RELOAD;
+  baseline->bucket_width = 1;
+  if (kernel_ptr_measure(baseline)) {
+    RESULT->kernel_cached_min = baseline->min;
+    RESULT->kernel_cached_median = baseline->median;
+  }
+
   for (int i = 0; i <= tries; i++) {
     ptr = take_branch[i] ? user_cache_line : kernel_cache_line;
     kernel_ptr_cache_flush();
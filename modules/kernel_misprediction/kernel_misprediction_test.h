@@ -12,6 +12,12 @@ typedef struct {
 
   u64 cache_line_time_access_tot;
   u64 cache_line_access_count;
+
+  // Kernel side baseline of the probe target, from the in-kernel loop
+  u64 kernel_uncached_min;
+  u64 kernel_uncached_median;
+  u64 kernel_cached_min;
+  u64 kernel_cached_median;
 } kernel_misprediction_result_t;
 
 #endif
@@ -13,7 +13,15 @@
 #include "commands.h"
 
 #define _MEM_IMPLEMENTATION
+#define _JIT_IMPLEMENTATION
+#define _THREAD_IMPLEMENTATION
+#define _TOPOLOGY_IMPLEMENTATION
+#define _RAND_IMPLEMENTATION
+#include "jit.h"
 #include "mem.h"
+#include "rand.h"
+#include "thread.h"
+#include "topology.h"
 
 void func(request_dependencies_t *);
 
@@ -46,8 +54,15 @@ static int run_test(void *args, cpuid_t cpu) {
   smp_data.func = &func;
   smp_data.args = args;
 
+  // This CPU spins until the test returns, no thread may be put on it
+  int issuer = get_cpu();
+  __thread_set_issuer(issuer);
+
   // Call the function on the specified CPU
   int ret = smp_call_function_single(cpu, __do_run_test_on_cpu, &smp_data, 1);
+
+  __thread_set_issuer(-1);
+  put_cpu();
   if (ret) {
     pr_err("tester: Failed to call function on CPU %d (Error: %d)\n", cpu, ret);
     return ret;
@@ -64,7 +79,8 @@ static long tester_ioctl(struct file *filp, unsigned int cmd,
   long ret = 0;
   usize allocated_deps = 0;
 
-  RESULT = kmalloc(sizeof(result_t), GFP_KERNEL);
+  // Zeroed, a test that bails out early must not hand back stale memory
+  RESULT = kzalloc(sizeof(result_t), GFP_KERNEL);
   if (RESULT == NULL) {
     printk("failed to malloc");
     ret = -ENOMEM;
@@ -138,8 +154,16 @@ static long tester_ioctl(struct file *filp, unsigned int cmd,
       }
     }
 
+    // Workers have to exist before the test disables IRQs
+    if (!__init_threads())
+      pr_err("tester: failed to start the worker threads\n");
+
+    if (request.args_count > 0)
+      rand_init_run(((calibration_t *)request.args[0])->seed, TEST_NAME_STR);
     run_test(request.args, request.cpu);
 
+    __deinit_threads();
+
     if (copy_to_user(request.ret, RESULT, sizeof(result_t))) {
       printk("Failed to copy result to the user");
       ret = -EINVAL;
@@ -20,6 +20,10 @@ s32 idx;
 
 #define TRAINING_LOOPS 1000
 
+// One page and one pointer for every TLB entry the size test can report
+#define KERNEL_ARENA_SZ                                                        \
+  (KERNEL_ARENA_DEFAULT_SZ + MAX_PAGES * (CACHE_LINE_SZ + sizeof(u8 *)))
+
 void func(request_dependencies_t *args) {
   cache_result_t *cache_r = args[1];
   tlb_result_t *tlb_r = args[2];
@@ -56,11 +60,20 @@ void func(request_dependencies_t *args) {
   volatile usize *user_cache_line = (volatile usize *)alloc(CACHE_LINE_SZ);
   volatile usize CACHE_LINE_ALIGNED *kernel_cache_line = get_kernel_ptr();
   volatile usize *ptr = user_cache_line;
+  struct probe_op *ring = probe_ring();
+  if (!ring) {
+    ker_close();
+    return;
+  }
 
   for (idx = 0; idx < cache_r->tries; idx++) {
     ptr = take_branch[idx] ? user_cache_line : kernel_cache_line;
-    kernel_ptr_cache_flush();
-    tlb_flush_page((void *)&ptr);
+
+    /* One round trip for the flushes instead of one ioctl each. */
+    ring[0] = (struct probe_op){.kind = PROBE_OP_FLUSH};
+    ring[1] = (struct probe_op){.kind = PROBE_OP_TLB_FLUSH_PAGE,
+                                .addr = (usize)&ptr};
+    probe_ring_submit(2);
     serialise();
     memory_barrier();
 
@@ -102,13 +115,16 @@ void func(request_dependencies_t *args) {
     }
 
     if (!real_branch) {
-      pte_restore_noflush((void *)&ptr);
+      /* Restore and time the probe buffer in the same submission. */
+      ring[0] = (struct probe_op){.kind = PROBE_OP_PTE_RESTORE,
+                                  .addr = (usize)&ptr};
+      ring[1] = (struct probe_op){.kind = PROBE_OP_BARRIER};
+      ring[2] = (struct probe_op){.kind = PROBE_OP_TIME_LOAD};
+      serialise();
+      memory_barrier();
+      probe_ring_submit(3);
+      sum += ring[2].result;
     }
-
-    serialise();
-    memory_barrier();
-
-    sum += get_kernel_time() * !real_branch;
   }
 
   RESULT->cache_line_time_access_tot = sum;
@@ -5,6 +5,7 @@
 #include "immintr.h"
 #include "mem.h"
 #include "rand.h"
+#include "stats.h"
 #include "types.h"
 
 AS_RESULT(lap_result_t);
@@ -13,25 +14,6 @@ AS_RESULT(lap_result_t);
 /* #define TRIES 1000 */
 #define TRIES 10
 
-void sort(u64 arr[], int n) {
-  u64 i, j, temp;
-  for (i = 0; i < n - 1; i++) {
-    for (j = 0; j < n - i - 1; j++) {
-      if (arr[j] > arr[j + 1]) {
-        // Swap arr[j] and arr[j+1]
-        temp = arr[j];
-        arr[j] = arr[j + 1];
-        arr[j + 1] = temp;
-      }
-    }
-  }
-}
-
-u64 median(u64 arr[], int n) {
-  sort(arr, n);
-  return arr[n / 2];
-}
-
 u64 measure(volatile u32 *arr, int iters) {
   u64 timings[TRIES] = {0};
   u64 t0, t1;
@@ -53,7 +35,7 @@ u64 measure(volatile u32 *arr, int iters) {
     timings[i] = t1 - t0;
   }
 
-  return median(timings, TRIES);
+  return stats_median(timings, TRIES);
 }
 
 u64 measure_unroll(volatile u32 *arr, int iters) {
@@ -78,7 +60,7 @@ u64 measure_unroll(volatile u32 *arr, int iters) {
     timings[i] = t1 - t0;
   }
 
-  return median(timings, TRIES);
+  return stats_median(timings, TRIES);
 }
 
 void func(request_dependencies_t *args) {
@@ -97,9 +79,7 @@ void func(request_dependencies_t *args) {
 
   const int WRITE_MAX = NUM_PAGES_BUF * PAGE_SIZE / sizeof(int);
 
-  for (int i = 0; i < WRITE_MAX; ++i) {
-    buf[i] = get_rand() % WRITE_MAX;
-  }
+  fill_random_below(buf, WRITE_MAX, WRITE_MAX);
 
   RESULT->random_time_unroll = measure_unroll(buf, iters);
   RESULT->random_time = measure(buf, iters);
@@ -7,48 +7,16 @@
 
 #include "../cache/cache_test.h"
 
-EXPORT_RESULT_SETUP(request_dependencies_t *dependencies) {
-  cache_result_t *cache_r = dependencies[1];
-  usize xor_amnt = 750;
-  str instructions = {0};
+EXPORT_RESULT_SETUP(request_dependencies_t *dependencies) { return OK; }
 
-  str_append_cstr(&instructions,
-                  tsprintf("#define nodep_xor_count %d\n", xor_amnt));
-
-  str_append_cstr(&instructions, "#ifdef TARGET_X86_64\n");
-  str_append_cstr(&instructions, "#define nodep_xor \\\n");
-  str_append_cstr(&instructions, "__asm__ __volatile__(\"\"\\\n");
-  for (int i = 0; i < xor_amnt; i++) {
-    str_append_cstr(&instructions,
-                    tsprintf("\"xor $%u, %%%%rbx\\n\"\\\n", rand()));
-  }
-  str_append_cstr(&instructions, "::: \"rbx\");\n");
-  str_append_cstr(&instructions, "#elif TARGET_RISCV\n");
-
-  str_append_cstr(&instructions, "#define nodep_xor \\\n");
-  str_append_cstr(&instructions, "__asm__ __volatile__(\"\"\\\n");
-  for (int i = 0; i < xor_amnt; i++) {
-    int imm = (rand() % 4096) - 2048;
-    str_append_cstr(&instructions, tsprintf("\"xori t0, t0, %d\\n\"\\\n", imm));
-  }
-  str_append_cstr(&instructions, "::: \"t0\");\n");
-
-  str_append_cstr(&instructions, "#endif \\\n");
-  da_append(&instructions, '\0');
+EXPORT_RESULT_STRUCT_SIZE() { return sizeof(o3_result_t); }
 
-  const char *inst_file = "instructions.h.out";
-  if (!write_to_file(inst_file, instructions.items)) {
-    plog(ERR, "Faild to write %s: %s", inst_file, strerror(errno));
+EXPORT_RESULT_STRUCT_DIAGNOSTICS(o3_result_t *result) {
+  if (result->jit_unsupported) {
+    plog(ERR, "The xor sleds could not be generated on this runner");
     return KO;
   }
-  da_free(&instructions);
-
-  return OK;
-}
 
-EXPORT_RESULT_STRUCT_SIZE() { return sizeof(o3_result_t); }
-
-EXPORT_RESULT_STRUCT_DIAGNOSTICS(o3_result_t *result) {
   result->nodep_instruction_time = result->nodep_instruction_time_tot;
   result->nodep_instruction_time /= result->tries;
   result->nodep_instruction_time -= result->overhead;
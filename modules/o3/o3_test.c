@@ -4,59 +4,118 @@
 #include "../tester.h"
 
 #include "immintr.h"
+#include "jit.h"
 #include "mem.h"
 #include "types.h"
 
-#include "instructions.h.out"
-
 AS_RESULT(o3_result_t);
 
 // TODO: Find the correct value before doing this
 #define CACHE_LINE_SZ 4096
 
+#ifdef RUNNER_KERNEL
+
+#define O3_XORS()                                                              \
+  __asm__ __volatile__(JIT_REPT(TOSTRING(O3_XOR_COUNT), JIT_XOR_INSN)          \
+                       ::: JIT_XOR_CLOBBER)
+
+// Same sleds as the ones emitted for the other runners
+static u64 o3_nodep_xor(volatile void *arr, volatile void *unused) {
+  const u64 start = get_cycle();
+  O3_XORS();
+  serialise();
+  memory_barrier();
+  return get_cycle() - start;
+}
+
+static u64 o3_load_nodep_xor(volatile void *arr, volatile void *unused) {
+  const u64 start = get_cycle();
+  load(arr);
+#ifdef MITIGATE
+  memory_barrier();
+#endif
+  O3_XORS();
+  serialise();
+  memory_barrier();
+  return get_cycle() - start;
+}
+
+static jit_func_t o3_sled(jit_t *j, bool with_load) {
+  (void)j;
+  return with_load ? o3_load_nodep_xor : o3_nodep_xor;
+}
+
+#else
+
+static jit_func_t o3_sled(jit_t *j, bool with_load) {
+  jit_reset(j);
+
+  jit_emit_cycle_start(j);
+  if (with_load) {
+    jit_emit_load(j, 0);
+#ifdef MITIGATE
+    jit_emit_memory_barrier(j);
+#endif
+  }
+  jit_emit_xors(j, O3_XOR_COUNT, 0);
+  jit_emit_serialise(j);
+  jit_emit_memory_barrier(j);
+  jit_emit_cycle_end(j);
+
+  return jit_finalize(j);
+}
+
+#endif
+
 void func(request_dependencies_t *args) {
   unsigned char arr[CACHE_LINE_SZ] = {};
 
   cache_result_t *cache_r = args[1];
-  RESULT->number_of_instructions = nodep_xor_count;
+  RESULT->number_of_instructions = O3_XOR_COUNT;
   RESULT->tries = cache_r->tries;
   RESULT->overhead = cache_r->overhead;
+  RESULT->jit_unsupported = true; // Until both sleds have run
+
+  // The kernel sleds are compiled in, there is nothing to map
+  jit_t j = {0};
+#ifndef RUNNER_KERNEL
+  if (!jit_init(&j, JIT_DEFAULT_CAP))
+    return;
+#endif
+
+  jit_func_t nodep_xor = o3_sled(&j, false);
+  if (!nodep_xor)
+    goto exit;
 
   usize sum = 0;
   for (int i = 0; i <= cache_r->tries; i++) {
     serialise();
     memory_barrier();
 
-    volatile u64 start = get_cycle();
-    nodep_xor;
-
-    serialise();
-    memory_barrier();
-    sum += (get_cycle() - start);
+    sum += nodep_xor(arr, arr);
   }
 
   RESULT->nodep_instruction_time_tot = sum;
 
+  jit_func_t load_nodep_xor = o3_sled(&j, true);
+  if (!load_nodep_xor)
+    goto exit;
+
   sum = 0;
   for (int i = 0; i <= cache_r->tries; i++) {
     cache_line_flush(arr);
     serialise();
     memory_barrier();
-    volatile u64 start = get_cycle();
-
-    load(arr);
-#ifdef MITIGATE
-    memory_barrier();
-#endif
-    nodep_xor;
 
-    serialise();
-    memory_barrier();
-    sum += (get_cycle() - start);
+    sum += load_nodep_xor(arr, arr);
   }
 
   RESULT->uncached_access_time_with_instruction_tot = sum;
   RESULT->uncached_access_time = cache_r->uncached_access_time;
+  RESULT->jit_unsupported = false;
+
+exit:
+  jit_free(&j);
 }
 
 #include "../tester.c"
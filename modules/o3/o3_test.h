@@ -6,8 +6,11 @@
 #include "../tester.h"
 #include "types.h"
 
+#define O3_XOR_COUNT 750
+
 typedef struct {
   // Measured
+  bool jit_unsupported; // No sled could be generated on this runner
   u64 number_of_instructions;
   u64 nodep_instruction_time_tot;
   u64 uncached_access_time_with_instruction_tot;
@@ -57,8 +57,17 @@ void func(request_dependencies_t *args) {
   for (int i = 0; i < 16; i++)
     small_array[i] = get_rand();
 
-  thread_t prod;
-  thread_create(&prod, producer_thread, (void *)0, 0);
+  usize victim = topology_current_cpu();
+  usize producer = companion_of(victim);
+
+  thread_pool_t prod = {0};
+  bool has_producer = producer != TOPOLOGY_NONE &&
+                      thread_pool_create(&prod, 1, (usize[]){producer}) &&
+                      thread_pool_start(&prod, producer_thread, 0);
+
+  // The producer is recorded as TOPOLOGY_NONE when it did not run
+  topology_describe(victim, &RESULT->victim);
+  topology_describe(has_producer ? producer : TOPOLOGY_NONE, &RESULT->producer);
 
   int total_hits = 0;
 
@@ -87,7 +96,9 @@ void func(request_dependencies_t *args) {
   }
 
   keep_running = 0;
-  thread_join(prod, 0);
+  if (has_producer)
+    thread_pool_join(&prod, 0);
+  thread_pool_destroy(&prod);
 
   RESULT->cache_line_time_access_tot = sum;
 }
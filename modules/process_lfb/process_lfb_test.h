@@ -12,6 +12,9 @@ typedef struct {
 
   u64 cache_line_time_access_tot;
   u64 cache_line_access_count;
+
+  topology_cpu_t victim;
+  topology_cpu_t producer;
 } process_lfb_result_t;
 
 #endif
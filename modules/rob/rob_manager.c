@@ -5,129 +5,26 @@
 #include "../../libs/lbstd.h"
 #include <stdlib.h>
 
+// Above it the readings before the jump are too noisy to trust it
+#define ROB_QUALITY_MAX_CV 0.1
+
 EXPORT_RESULT_SETUP(request_dependencies_t *dependencies) {
-  usize max_size = 512;
-  usize *iterations = dependencies[0];
-  *iterations = sqrt_u(*iterations);
-  str instructions = {0};
-
-  const char *ifmt = "#define itest%d \\\n"
-                     "for (s32 i = 0; i < RESULT->iterations; i++) {\\\n"
-                     "cache_line_flush(ptr1);\\\n"
-                     "cache_line_flush(ptr2);\\\n"
-                     "serialise(); memory_barrier();\\\n"
-                     "volatile usize start = get_cycle();\\\n"
-                     /* "__asm__ __volatile__ (ninst%d);\\\n" */
-                     "ninst%d;\\\n"
-                     "load(ptr1);\\\n"
-                     /* "__asm__ __volatile__ (ninst%d);\\\n" */
-                     "ninst%d;\\\n"
-                     "load(ptr2);\\\n"
-                     /* "__asm__ __volatile__ (ninst%d);\\\n" */
-                     "ninst%d;\\\n"
-                     "volatile usize end = get_cycle();\\\n"
-                     "RESULT->raw_readings_nop[%d] += end - start;\\\n"
-                     "}\n";
-
-  const char *ifmt_mitigate =
-      "#define itest%d \\\n"
-      "for (s32 i = 0; i < RESULT->iterations; i++) {\\\n"
-      "cache_line_flush(ptr1);\\\n"
-      "cache_line_flush(ptr2);\\\n"
-      "serialise(); memory_barrier();\\\n"
-      "volatile usize start = get_cycle();\\\n"
-      /* "__asm__ __volatile__ (ninst%d);\\\n" */
-      "ninst%d;\\\n"
-
-      "serialise(); \\\n"
-
-      "load(ptr1);\\\n"
-      "serialise(); \\\n"
-
-      /* "__asm__ __volatile__ (ninst%d);\\\n" */
-      "ninst%d;\\\n"
-      "serialise(); \\\n"
-      "load(ptr2);\\\n"
-      "serialise(); \\\n"
-      /* "__asm__ __volatile__ (ninst%d);\\\n" */
-      "ninst%d;\\\n"
-      "serialise(); \\\n"
-      "volatile usize end = get_cycle();\\\n"
-      "RESULT->raw_readings_nop[%d] += end - start;\\\n"
-      "}\n";
-
-  /* const char *xfmt = "#define xtest%d \\\n" */
-  /*                    "for (s32 i = 0; i < RESULT->iterations; i++) {\\\n" */
-  /*                    "cache_line_flush(ptr1);\\\n" */
-  /*                    "cache_line_flush(ptr2);\\\n" */
-  /*                    "serialise(); memory_barrier();\\\n" */
-  /*                    "volatile usize start = get_cycle();\\\n" */
-  /*                    /\* "__asm__ __volatile__ (xinst%d:::\"ebx\");\\\n" *\/
-   */
-  /*                    "xinst%d;\\\n" */
-  /*                    "load(ptr1);\\\n" */
-  /*                    /\* "__asm__ __volatile__ (xinst%d:::\"ebx\");\\\n" *\/
-   */
-  /*                    "xinst%d;\\\n" */
-  /*                    "load(ptr2);\\\n" */
-  /*                    /\* "__asm__ __volatile__ (xinst%d:::\"ebx\");\\\n" *\/
-   */
-  /*                    "xinst%d;\\\n" */
-  /*                    /\* "serialise(); memory_barrier();\\\n" *\/ */
-  /*                    "volatile usize end = get_cycle();\\\n" */
-  /*                    "RESULT->raw_readings_xor[%d] += end - start;\\\n" */
-  /*                    "}\n"; */
-
-  str_append_cstr(&instructions, tsprintf("unsigned long long __x_ = 0;\n"));
-  str_append_cstr(&instructions, tsprintf("#define ninst1 nop_nomem;\n"));
-  /* str_append_cstr(&instructions, tsprintf("#define xinst1 add(__x_)\n")); */
-
-  str_append_cstr(&instructions, "#ifdef MITIGATE\n");
-  str_append_cstr(&instructions, tsprintf(ifmt_mitigate, 1, 1, 1, 1, 1));
-  str_append_cstr(&instructions, "#else\n");
-  str_append_cstr(&instructions, tsprintf(ifmt, 1, 1, 1, 1, 1));
-  str_append_cstr(&instructions, "#endif\n");
-  /* str_append_cstr(&instructions, tsprintf(xfmt, 1, 1, 1, 1, 1)); */
-  for (s32 i = 2; i < max_size; i++) {
-    str_append_cstr(&instructions,
-                    tsprintf("#define ninst%d ninst%d ninst1\n", i, i - 1));
-    /* str_append_cstr(&instructions, */
-    /*                 tsprintf("#define xinst%d xinst%d xinst1\n", i, i - 1));
-     */
-
-    str_append_cstr(&instructions, "#ifdef MITIGATE\n");
-    str_append_cstr(&instructions, tsprintf(ifmt_mitigate, i, i, i, i, i));
-    str_append_cstr(&instructions, "#else\n");
-    str_append_cstr(&instructions, tsprintf(ifmt, i, i, i, i, i));
-    str_append_cstr(&instructions, "#endif\n");
-    /* str_append_cstr(&instructions, tsprintf(xfmt, i, i, i, i, i)); */
-  }
+  calibration_t *calibration = dependencies[0];
+  calibration->budget = sqrt_u(calibration->budget);
 
-  str_append_cstr(&instructions, tsprintf("#define run_battery_i "));
-  for (s32 i = 1; i < max_size; i++) {
-    str_append_cstr(&instructions, tsprintf("itest%d ", i));
-  }
-  str_append_cstr(&instructions, tsprintf("\n"));
-  /* str_append_cstr(&instructions, tsprintf("#define run_battery_x ")); */
-  /* for (s32 i = 1; i < max_size; i++) { */
-  /*   str_append_cstr(&instructions, tsprintf("xtest%d ", i)); */
-  /* } */
-  /* str_append_cstr(&instructions, tsprintf("\n")); */
-  da_append(&instructions, '\0');
-
-  const char *inst_file = "instructions.h.out";
-  if (!write_to_file(inst_file, instructions.items)) {
-    plog(ERR, "Faild to write %s: %s", inst_file, strerror(errno));
-    return KO;
-  }
-  da_free(&instructions);
   return OK;
 }
 
 EXPORT_RESULT_STRUCT_SIZE() { return sizeof(rob_result_t); }
 
 EXPORT_RESULT_STRUCT_DIAGNOSTICS(rob_result_t *result) {
-  usize max_size = 512;
+  if (result->jit_unsupported) {
+    plog(ERR, "The nop sleds could not be generated on this runner");
+    return KO;
+  }
+
+  usize max_size = ROB_MAX_SIZE;
+  plog(INFO, "rejected samples: %llu", result->rejected_samples);
   result->raw_readings_nop[0] = result->raw_readings_nop[1];
   result->raw_readings_xor[0] = result->raw_readings_xor[1];
   for (s32 i = 0; i < max_size; i++) {
@@ -159,3 +56,18 @@ EXPORT_RESULT_STRUCT_DIAGNOSTICS(rob_result_t *result) {
   /* result->register_file_size = reg_size; */
   return OK;
 }
+
+EXPORT_RESULT_QUALITY(rob_result_t *result, double *quality) {
+  // Running it again would not generate the sleds either
+  if (result->jit_unsupported) {
+    *quality = 0;
+    return true;
+  }
+
+  // Spread of the plateau before the ROB fills, or of the whole curve when
+  // there was no jump
+  const s32 n = result->rob_size > 1 ? result->rob_size - 1 : ROB_MAX_SIZE - 1;
+  *quality = coefficient_of_variation(n, &result->readings_nop[1]);
+
+  return *quality <= ROB_QUALITY_MAX_CV;
+}
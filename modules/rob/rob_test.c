@@ -3,21 +3,156 @@
 #include "../tester.h"
 
 #include "immintr.h"
+#include "jit.h"
 #include "mem.h"
+#include "stats.h"
 #include "types.h"
 
-#include "instructions.h.out"
 AS_RESULT(rob_result_t);
 
+#define ROB_BUFFER_SZ (4096 * 1024)
+#define KERNEL_ARENA_SZ (KERNEL_ARENA_DEFAULT_SZ + 2 * ROB_BUFFER_SZ)
+
+// Runs of the empty sled that give its fixed cost
+#define ROB_BASE_RUNS 16
+
+#ifdef RUNNER_KERNEL
+
+#ifdef MITIGATE
+#define ROB_FENCE() serialise()
+#else
+#define ROB_FENCE()
+#endif
+
+#define ROB_NOPS(a, b, c)                                                      \
+  __asm__ __volatile__(JIT_REPT(JIT_LEN_STR(a, b, c), "nop"))
+
+// Same sled as the one emitted for the other runners
+#define ROB_SLED(a, b, c)                                                      \
+  static u64 rob_sled_##a##b##c(volatile void *ptr1, volatile void *ptr2) {   \
+    const u64 start = get_cycle();                                             \
+    ROB_NOPS(a, b, c);                                                         \
+    ROB_FENCE();                                                               \
+    load(ptr1);                                                                \
+    ROB_FENCE();                                                               \
+    ROB_NOPS(a, b, c);                                                         \
+    ROB_FENCE();                                                               \
+    load(ptr2);                                                                \
+    ROB_FENCE();                                                               \
+    ROB_NOPS(a, b, c);                                                         \
+    ROB_FENCE();                                                               \
+    return get_cycle() - start;                                                \
+  }
+#define ROB_SLED_ENTRY(a, b, c) rob_sled_##a##b##c,
+
+_Static_assert(ROB_MAX_SIZE == 512, "the sleds are generated for 512 lengths");
+
+JIT_EACH_512(ROB_SLED)
+static const jit_func_t rob_sleds[ROB_MAX_SIZE] = {
+    JIT_EACH_512(ROB_SLED_ENTRY)};
+
+static jit_func_t rob_sled(jit_t *j, usize n) {
+  (void)j;
+  return rob_sleds[n];
+}
+
+#else
+
+static jit_func_t rob_sled(jit_t *j, usize n) {
+  jit_reset(j);
+
+  jit_emit_cycle_start(j);
+  jit_emit_nops(j, n);
+#ifdef MITIGATE
+  jit_emit_serialise(j);
+#endif
+  jit_emit_load(j, 0);
+#ifdef MITIGATE
+  jit_emit_serialise(j);
+#endif
+  jit_emit_nops(j, n);
+#ifdef MITIGATE
+  jit_emit_serialise(j);
+#endif
+  jit_emit_load(j, 1);
+#ifdef MITIGATE
+  jit_emit_serialise(j);
+#endif
+  jit_emit_nops(j, n);
+#ifdef MITIGATE
+  jit_emit_serialise(j);
+#endif
+  jit_emit_cycle_end(j);
+
+  return jit_finalize(j);
+}
+
+#endif
+
+static u64 rob_run(jit_func_t sled, void *ptr1, void *ptr2) {
+  cache_line_flush(ptr1);
+  cache_line_flush(ptr2);
+  serialise();
+  memory_barrier();
+
+  return sled(ptr1, ptr2);
+}
+
+// Fixed cost of a sled, the two misses and the fences. With MITIGATE the
+// fences alone can exceed SAMPLE_MAX_CYCLES when cpuid traps to a hypervisor,
+// so the rejection bound of every length is put on top of it.
+static u64 rob_base_cycles(jit_t *j, void *ptr1, void *ptr2) {
+  jit_func_t sled = rob_sled(j, 0);
+  if (!sled)
+    return 0;
+
+  u64 runs[ROB_BASE_RUNS];
+  for (usize i = 0; i < ROB_BASE_RUNS; i++)
+    runs[i] = rob_run(sled, ptr1, ptr2);
+
+  return stats_median(runs, ROB_BASE_RUNS);
+}
+
 void func(request_dependencies_t *args) {
-  void *ptr1 = alloc(4096 * 1024);
-  void *ptr2 = alloc(4096 * 1024);
+  void *ptr1 = alloc(ROB_BUFFER_SZ);
+  void *ptr2 = alloc(ROB_BUFFER_SZ);
+
+  RESULT->iterations = ((calibration_t *)args[0])->budget;
+  RESULT->rejected_samples = 0;
+  RESULT->jit_unsupported = false;
+
+  // The kernel sleds are compiled in, there is nothing to map
+  jit_t j = {0};
+#ifndef RUNNER_KERNEL
+  if (!jit_init(&j, JIT_DEFAULT_CAP)) {
+    RESULT->jit_unsupported = true;
+    return;
+  }
+#endif
+
+  const u64 base = rob_base_cycles(&j, ptr1, ptr2);
+
+  for (usize n = 1; n < ROB_MAX_SIZE; n++) {
+    jit_func_t sled = rob_sled(&j, n);
+    if (!sled) {
+      RESULT->jit_unsupported = true;
+      break;
+    }
+
+    for (s32 i = 0; i < RESULT->iterations; i++) {
+      // And the three runs of n nops, a tick each is more than they take
+      sample_t smp = {.max_cycles = SAMPLE_MAX_CYCLES + base + 3 * n};
+      u64 delta;
+      do {
+        sample_begin(&smp);
+        delta = rob_run(sled, ptr1, ptr2);
+      } while (sample_rejected(&smp, delta, &RESULT->rejected_samples));
 
-  RESULT->iterations = *(u64 *)args[0];
+      RESULT->raw_readings_nop[n] += delta;
+    }
+  }
 
-  /* run_battery_x; */
-  run_battery_i;
-  /* run_battery; */
+  jit_free(&j);
 }
 
 #include "../tester.c"
@@ -6,14 +6,19 @@
 #include "../tester.h"
 #include "types.h"
 
+#define ROB_MAX_SIZE 512
+
 typedef struct {
   usize iterations;
-  usize raw_readings_nop[512];
-  double readings_nop[512] TO_PLOT("line", "plot1") AXIS(Y, "latency", 512)
-      AXIS(X, "instruction_count", 512) VALUES("rob_size");
+  u64 rejected_samples; // Contaminated and taken again
+  bool jit_unsupported; // No sled could be generated on this runner
+  usize raw_readings_nop[ROB_MAX_SIZE];
+  double readings_nop[ROB_MAX_SIZE] TO_PLOT("line", "plot1")
+      AXIS(Y, "latency", 512)
+          AXIS(X, "instruction_count", 512) VALUES("rob_size");
 
-  usize raw_readings_xor[512];
-  double readings_xor[512];
+  usize raw_readings_xor[ROB_MAX_SIZE];
+  double readings_xor[ROB_MAX_SIZE];
   /* TO_PLOT("line", "plot1") AXIS(Y, "latency", 512) */
   /*       AXIS(X, "instruction_count", 512) VALUES("register_file_size"); */
 
@@ -1,23 +1,114 @@
+#ifndef _SIMULATION_TESTER
+#define _SIMULATION_TESTER
+
 #include "tester.h"
 
 #include <stdio.h>
+#include <string.h>
 
 #include "commands.h"
 #include "unistd.h"
 
 #define _MEM_IMPLEMENTATION
 #define _THREAD_IMPLEMENTATION
+#define _JIT_IMPLEMENTATION
+#define _TOPOLOGY_IMPLEMENTATION
+#define _RAND_IMPLEMENTATION
 #include "delim.h"
+#include "jit.h"
 #include "mem.h"
+#include "rand.h"
 #include "thread.h"
+#include "topology.h"
 #include "types.h"
 
+#ifdef SIM_BUNDLE
+
+// Several modules are linked in the same binary, the generated test.c defines
+// one entry per module. They run back to back on hart 0 and each one prints
+// its own frame: DELIM, module name, NUL, result struct, DELIM
+struct sim_bundle_entry {
+  const char *name;
+  void (*run)(void);
+};
+
+extern const struct sim_bundle_entry sim_bundle[];
+extern const usize sim_bundle_count;
+
+void sim_bundle_frame(const char *name, const void *result, usize size) {
+  printf(DELIM);
+  write(STDOUT_FILENO, name, strlen(name) + 1);
+  write(STDOUT_FILENO, result, size);
+  printf(DELIM);
+}
+
+static void *bundle_thread(void *arg) {
+  (void)arg;
+
+  __init_alloc();
+  usize mark = alloc_mark();
+  for (usize i = 0; i < sim_bundle_count; i++) {
+    // Every module starts from an empty arena
+    sim_bundle[i].run();
+    alloc_reset(mark);
+  }
+  __deinit_alloc();
+
+  scheduler_running = false;
+  return NULL;
+}
+
+void boot_hart0_main(void) {
+  thread_t main_thread;
+  thread_create(&main_thread, bundle_thread, NULL, 0);
+
+  hart_scheduler_loop();
+
+  thread_join(main_thread, NULL);
+}
+
+#else
+
 extern result_t *RESULT;
+
+#ifdef SIM_CHECKPOINT
+
+#define SIM_ARGS_SZ (16 * 1024)
+#define SIM_MAX_ARGS 64
+
+// Patched by the orchestrator in the memory image restored from the
+// checkpoint, same layout as the __args array of args.h.in
+u8 __sim_args[SIM_ARGS_SZ] __attribute__((aligned(8), used));
+void *args[SIM_MAX_ARGS];
+
+// The checkpoint is taken when hart 0 gets here, nothing before this may
+// depend on the arguments
+__attribute__((noinline, used)) void sim_checkpoint(void) {
+  __asm__ __volatile__("" ::: "memory");
+}
+
+static void load_args(void) {
+  usize count;
+  memcpy(&count, __sim_args, sizeof(count));
+
+  usize idx = sizeof(usize) * 2; // count and cpu
+  for (usize i = 0; i < count && i < SIM_MAX_ARGS; i++) {
+    usize size;
+    memcpy(&size, &__sim_args[idx], sizeof(size));
+    idx += sizeof(size);
+    args[i] = &__sim_args[idx];
+    idx += size;
+  }
+}
+
+#else
 extern void *args[];
+#endif
 
 // Wrapper for func to match thread signature
 static void *func_thread(void *arg) {
   (void)arg;
+  rand_init_run(((calibration_t *)args[0])->seed, TEST_NAME_STR);
   func(args);
 
   scheduler_running = false;
@@ -29,6 +120,11 @@ void boot_hart0_main(void) {
   __init_alloc();
   RESULT = calloc(1, sizeof(*RESULT));
 
+#ifdef SIM_CHECKPOINT
+  sim_checkpoint();
+  load_args();
+#endif
+
   thread_t main_thread;
   thread_create(&main_thread, func_thread, NULL, 0);
 
@@ -46,6 +142,8 @@ void boot_hart0_main(void) {
   __deinit_alloc();
 }
 
+#endif
+
 int main(void) {
   // On single-core, NUM_HARTS == 1
   // On multi-core, hart 0 will call boot_hart0_main(), others boot_other_hart()
@@ -59,3 +157,5 @@ int main(void) {
 
   return 0;
 }
+
+#endif // _SIMULATION_TESTER
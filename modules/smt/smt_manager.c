@@ -18,6 +18,11 @@ EXPORT_RESULT_STRUCT_DIAGNOSTICS(smt_result_t *result) {
   result->different_core_time =
       (double)result->different_core_time_tot / result->iterations;
 
+  plog(INFO, "primary cpu %u (core %u, package %u)", result->primary.cpu,
+       result->primary.core, result->primary.package);
+  plog(INFO, "sibling cpu %d, other core cpu %d", (s32)result->sibling.cpu,
+       (s32)result->other_core.cpu);
+
   plog(INFO, "alone %f", result->alone_thread_time);
   plog(INFO, "same t %f", result->same_thread_time);
   plog(INFO, "same c %f", result->same_core_time);
@@ -15,16 +15,11 @@ typedef struct {
   usize iterations;
 } thread_arg;
 
-volatile int start_flag;
-
 void *busy_loop(void *arg) {
   thread_arg *t = (thread_arg *)arg;
 
   volatile usize sum = 0;
 
-  while (start_flag == 0)
-    ;
-
   volatile usize start = get_cycle();
   for (unsigned long i = 0; i < t->iterations; i++) {
     sum += i;
@@ -37,67 +32,87 @@ void *busy_loop(void *arg) {
   return t;
 }
 
-void func(request_dependencies_t *args) {
-  /* RESULT->iterations = 1000000000; */
-  RESULT->iterations = 10000;
+// Workers of the pool, a CPU the machine lacks is replaced by the primary
+enum {
+  SMT_PRIMARY,
+  SMT_SAME_THREAD, // The primary again
+  SMT_SIBLING,
+  SMT_OTHER_CORE,
+  SMT_WORKERS,
+};
 
-  thread_arg a1 = {.iterations = RESULT->iterations};
-  thread_arg a2 = {.iterations = RESULT->iterations};
+#define SMT_WITH(w) ((1u << SMT_PRIMARY) | (1u << (w)))
 
-  thread_t t1 = 0;
-  thread_t t2 = 0;
+// Runs busy_loop on the `active` workers at once, returns the mean time
+usize run_together(thread_pool_t *pool, u32 active, thread_arg args[]) {
+  void *pool_args[SMT_WORKERS];
+  for (usize i = 0; i < SMT_WORKERS; i++)
+    pool_args[i] = &args[i];
 
-  thread_create(&t1, busy_loop, &a1, 0);
   serialise();
-  start_flag = 1;
-  thread_join(t1, 0);
-  start_flag = 0;
+  if (!thread_pool_start_some(pool, active, busy_loop, pool_args))
+    return 0;
+  thread_pool_join(pool, 0);
   memory_barrier();
 
-  RESULT->alone_thread_time_tot = a1.result;
-
-  thread_create(&t1, busy_loop, &a1, 0);
-  thread_create(&t2, busy_loop, &a2, 0);
-
-  serialise();
-  start_flag = 1;
-  thread_join(t1, 0);
-  thread_join(t2, 0);
-  start_flag = 0;
-  memory_barrier();
+  usize sum = 0, count = 0;
+  for (usize i = 0; i < SMT_WORKERS; i++) {
+    if (active & (1u << i)) {
+      sum += args[i].result;
+      count++;
+    }
+  }
 
-  RESULT->same_thread_time_tot =
-      (a1.result + a2.result) >> 1; // This is just the mean
+  return sum / count;
+}
 
-  thread_create(&t1, busy_loop, &a1, 0);
-#ifdef MITIGATE
-  thread_create(&t2, busy_loop, &a2, 0);
-#else
-  thread_create(&t2, busy_loop, &a2, 1);
-#endif
+void func(request_dependencies_t *args) {
+  /* RESULT->iterations = 1000000000; */
+  RESULT->iterations = 10000;
 
-  serialise();
-  start_flag = 1;
-  thread_join(t1, 0);
-  thread_join(t2, 0);
-  start_flag = 0;
-  memory_barrier();
+  thread_arg a[SMT_WORKERS];
+  for (usize i = 0; i < SMT_WORKERS; i++)
+    a[i] = (thread_arg){.iterations = RESULT->iterations};
 
-  RESULT->same_core_time_tot =
-      (a1.result + a2.result) >> 1; // This is just the mean
+  usize primary = topology_current_cpu();
+  if (primary == TOPOLOGY_NONE)
+    primary = 0;
 
-  thread_create(&t1, busy_loop, &a1, 0);
-  thread_create(&t2, busy_loop, &a2, 2);
+  // Without a sibling or another core the pair shares the primary, the
+  // diagnostics then report the missing level instead of a bogus one
+  usize sibling = sibling_of(primary);
+  usize other_core = other_core_same_package(primary);
 
-  serialise();
-  start_flag = 1;
-  thread_join(t1, 0);
-  thread_join(t2, 0);
-  start_flag = 0;
-  memory_barrier();
+#ifdef MITIGATE
+  sibling = TOPOLOGY_NONE;
+#endif
 
+  topology_describe(primary, &RESULT->primary);
+  topology_describe(sibling, &RESULT->sibling);
+  topology_describe(other_core, &RESULT->other_core);
+
+  const usize cpus[SMT_WORKERS] = {
+      [SMT_PRIMARY] = primary,
+      [SMT_SAME_THREAD] = primary,
+      [SMT_SIBLING] = sibling == TOPOLOGY_NONE ? primary : sibling,
+      [SMT_OTHER_CORE] = other_core == TOPOLOGY_NONE ? primary : other_core,
+  };
+
+  // Workers are created and pinned once, every phase starts the ones it needs
+  // and only the barrier release is between them and the measured loop
+  thread_pool_t pool;
+  if (!thread_pool_create(&pool, SMT_WORKERS, cpus))
+    return;
+
+  RESULT->alone_thread_time_tot =
+      run_together(&pool, 1u << SMT_PRIMARY, a);
+  RESULT->same_thread_time_tot =
+      run_together(&pool, SMT_WITH(SMT_SAME_THREAD), a);
+  RESULT->same_core_time_tot = run_together(&pool, SMT_WITH(SMT_SIBLING), a);
   RESULT->different_core_time_tot =
-      (a1.result + a2.result) >> 1; // This is just the mean
+      run_together(&pool, SMT_WITH(SMT_OTHER_CORE), a);
+
+  thread_pool_destroy(&pool);
 }
 
 #include "../tester.c"
@@ -9,6 +9,11 @@
 typedef struct {
   usize iterations;
 
+  // Where the pairs ran, ids are ~0 when the machine has no such CPU
+  topology_cpu_t primary;
+  topology_cpu_t sibling;
+  topology_cpu_t other_core;
+
   u64 alone_thread_time_tot;
   u64 same_thread_time_tot;
   u64 same_core_time_tot;
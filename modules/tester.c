@@ -1,6 +1,7 @@
 #include "tester.h"
 
-#ifdef _MEM_IMPLEMENTATION
+// A simulation bundle includes this once per module
+#if defined(_MEM_IMPLEMENTATION) && !defined(SIM_BUNDLE)
 #error Cant define _MEM_IMPLEMENTATION in the tester module
 #endif
 
@@ -26,6 +26,7 @@ typedef enum {
 } result_code_t;
 
 #include "commands.h"
+#include "../include/topology.h"
 
 #define EXPORT_RESULT_STRUCT_SIZE() u64 CAT3(TEST_NAME, _result, size)(void)
 
@@ -34,6 +35,11 @@ typedef enum {
 
 #define EXPORT_RESULT_SETUP(S) result_code_t CAT3(TEST_NAME, _result, setup)(S)
 
+// Optional, scores the result in Q and returns false when it is too noisy to
+// keep, the orchestrator then measures it again
+#define EXPORT_RESULT_QUALITY(S, Q)                                            \
+  bool CAT3(TEST_NAME, _result, quality)(S, Q)
+
 #define X "x"
 #define Y "y"
 #define STR(x) #x
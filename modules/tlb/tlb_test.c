@@ -9,6 +9,7 @@
 AS_RESULT(tlb_result_t);
 
 #define PAGE_SIZE 4096
+#define KERNEL_ARENA_SZ (MAX_PAGES * PAGE_SIZE + MAX_PAGES * sizeof(char *))
 
 void func(request_dependencies_t *args) {
   // TODO: Optimize this, uses too much RAM
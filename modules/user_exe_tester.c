@@ -13,8 +13,14 @@
 
 #define _MEM_IMPLEMENTATION
 #define _THREAD_IMPLEMENTATION
+#define _JIT_IMPLEMENTATION
+#define _TOPOLOGY_IMPLEMENTATION
+#define _RAND_IMPLEMENTATION
+#include "jit.h"
 #include "mem.h"
 /* #include "thread.h" */
+#include "rand.h"
+#include "topology.h"
 #include "delim.h"
 #include "types.h"
 
@@ -35,6 +41,7 @@ bool run_test(request_dependencies_t *args, cpuid_t cpu) {
   /*   return false; */
   /* } */
 
+  rand_init_run(((calibration_t *)args[0])->seed, TEST_NAME_STR);
   func(args);
 
   return true;
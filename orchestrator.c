@@ -5,14 +5,20 @@
 #include "modules/tester.h"
 #include "sys/stat.h"
 #include <dlfcn.h>
+#include <elf.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <poll.h>
+#include <pthread.h>
+#include <linux/perf_event.h>
 #include <linux/sched.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/ioctl.h>
 #include <sys/resource.h>
 #include <sys/syscall.h>
+#include <sys/wait.h>
+#include <signal.h>
 #include <time.h>
 #include <unistd.h>
 
@@ -29,6 +35,26 @@
 
 #define DEFAULT_STR_MAX_SIZE 32
 
+// First word of the run files, the ones from before the telemetry start with
+// the test count. After every result "TEARUN04" has the telemetry, the quality
+// gate and the phase timings, "TEARUN03" the first two and "TEARUN02" only
+// the telemetry.
+#define RUN_FILE_MAGIC 0x34304e5552414554ULL
+#define RUN_FILE_MAGIC_QUALITY 0x33304e5552414554ULL
+#define RUN_FILE_MAGIC_TELEMETRY 0x32304e5552414554ULL
+
+// Measurements of a test whose result does not pass its quality metric, the
+// first one included
+#define QUALITY_DEFAULT_ATTEMPTS 5
+
+// Wait before the second measurement, doubled for every following one
+#define QUALITY_BACKOFF_MS 100
+#define QUALITY_MAX_BACKOFF_MS 2000
+
+// Harts of the simulated config, the tester is built with the same NUM_HARTS
+// and spike takes the checkpoint with as many
+#define SIM_DEFAULT_HARTS 4
+
 #define EACH_RUNNER(X)                                                         \
   X(RUNNER_KERNEL)                                                             \
   X(RUNNER_USER)                                                               \
@@ -61,6 +87,31 @@ typedef_enum(simulation_impl_t, EACH_SIMULATION_IMPL);
 
 typedef_enum(target_t, EACH_TARGET);
 
+#define EACH_QUIET_SETTING(X)                                                  \
+  X(QUIET_GOVERNOR)                                                            \
+  X(QUIET_TURBO)                                                               \
+  X(QUIET_CSTATES)                                                             \
+  X(QUIET_IRQS)                                                                \
+  X(QUIET_RCU)                                                                 \
+  X(QUIET_NUM)
+
+typedef_enum(quiet_setting_t, EACH_QUIET_SETTING);
+
+// Where the wall time of a test goes, analyzer.py has the same list
+#define EACH_PHASE(X)                                                          \
+  X(PHASE_DEPENDENCIES)                                                        \
+  X(PHASE_MANAGER_BUILD)                                                       \
+  X(PHASE_MANAGER_LOAD)                                                        \
+  X(PHASE_BUILD)                                                               \
+  X(PHASE_LOAD)                                                                \
+  X(PHASE_RUN)                                                                 \
+  X(PHASE_DIAGNOSTICS)                                                         \
+  X(PHASE_UNLOAD)                                                              \
+  X(PHASE_BACKOFF)                                                             \
+  X(PHASE_NUM)
+
+typedef_enum(phase_t, EACH_PHASE);
+
 #define SILENCE_WARNINGS                                                       \
   "-Wno-attributes", "-Wno-cpp", "-Wno-unused-parameter",                      \
       "-fno-optimize-sibling-calls"
@@ -75,6 +126,12 @@ char *kernel_header_dir;
 
 bool running_all = false;
 
+// Simulation slot used by this process, see sim_tests_dir()
+usize sim_slot = 0;
+
+// Measured by calibrate(), args[0] of every test
+calibration_t calibration = {0};
+
 typedef struct {
   target_t target;
   runner_t runner;
@@ -86,9 +143,20 @@ typedef struct {
   const char *to_mitigate;
   bool save;
   const char *save_file_name;
+  bool quiet_machine;
+  bool isolate;
+  const char *isolate_cpus;
+  usize quality_attempts;
+  const char *trace_file;
+  u32 seed;
 
   struct {
     const char *shell;
+    usize bundle;
+    usize slots;
+    usize heap_size;
+    usize harts;
+    bool checkpoint;
 
     struct {
       const char *directory;
@@ -96,6 +164,44 @@ typedef struct {
   } extra_sim_options;
 } run_options_t;
 
+// State of the machine while a test ran, the counters are deltas between its
+// start and end. Stored after the result in the run file.
+typedef struct {
+  u64 duration_ns;
+  u64 interrupts; // On the test CPU
+  u64 softirqs;   // On the test CPU
+  u64 voluntary_switches;
+  u64 involuntary_switches;
+  u64 throttles;     // Core and package thermal throttle events
+  u64 min_freq_khz;  // scaling_cur_freq of the test CPU over the samples
+  u64 max_freq_khz;
+  u64 max_temp_mc; // Hottest thermal zone, millidegrees
+  u64 samples;
+} telemetry_t;
+
+#define QUALITY_UNGATED 0 // The manager has no quality metric
+#define QUALITY_PASSED 1
+#define QUALITY_FAILED 2 // Still failing when the attempts ran out
+
+// Outcome of the quality gate, stored after the telemetry in the run file
+typedef struct {
+  double value; // Module defined metric of the kept result
+  u32 attempts;
+  u32 status;
+} quality_t;
+
+// Wall time of every phase, and CPU time of the child processes (compilers,
+// kbuild, insmod, simulators) reaped during it. Stored after the quality.
+typedef struct {
+  u64 wall_ns[PHASE_NUM];
+  u64 child_ns[PHASE_NUM];
+} phases_t;
+
+typedef struct {
+  u64 wall_ns;
+  u64 child_ns;
+} phase_clock_t;
+
 typedef struct {
   const char *module_name;
   const char *module_path;
@@ -109,16 +215,34 @@ typedef struct {
   result_code_t result_code;
   void *result;
   usize result_size;
+  telemetry_t telemetry;
+  quality_t quality;
+  phases_t phases;
 } test_t;
 
+// Result of the "root" entry of the run file, every test gets it as its last
+// argument and analyzer.py reads it in parse_root()
+typedef struct {
+  calibration_t calibration;
+  u64 quiet_settings; // Bit i is set when quiet_setting_t i was applied
+} root_result_t;
+
 typedef struct {
   void *shlib;
 
   bool (*setup)(request_dependencies_t *);
   u64 (*get_result_size)();
   result_code_t (*get_result_diagnostics)(request_return_t *);
+  // Optional, true when the result is clean enough to keep
+  bool (*get_result_quality)(request_return_t *, double *);
 } manager_t;
 
+// A test ready to run: its arguments are built and the manager is set up
+typedef struct {
+  manager_t manager;
+  struct run_function_request req;
+} prepared_test_t;
+
 da(test_t) runned_test = {0};
 
 int test_cmp(test_t t1, test_t t2);
@@ -138,6 +262,19 @@ const char *make_shared_lib(cmd_t *c, const char *name, int n, bool mitigate,
 bool compile_user_module(cmd_t c[static 1], test_t *test);
 bool compile_kernel_module(cmd_t c[static 1], test_t *test);
 bool compile_simulation_module(cmd_t c[static 1], test_t *test);
+const char *sim_tests_dir(run_options_t *opts);
+bool sim_slot_setup(cmd_t c[static 1], run_options_t *opts, usize slot);
+bool build_simulation_binary(cmd_t c[static 1], run_options_t *opts);
+bool run_simulator(cmd_t c[static 1], run_options_t *opts, const char *image,
+                   const char *loadarch, usize expected, str *out);
+bool sim_symbol_address(cmd_t c[static 1], run_options_t *opts,
+                        const char *binary, const char *symbol,
+                        u64 out[static 1]);
+bool sim_checkpoint_image(cmd_t c[static 1], test_t *t,
+                          struct run_function_request req,
+                          const char *image[static 1],
+                          const char *loadarch[static 1]);
+bool elf_patch(str *elf, u64 addr, const void *data, usize size);
 bool compile_kmod(cmd_t c[static 1], const char mkfile[static 1],
                   const char kmod_dir[static 1]);
 bool load_kmod(cmd_t c[static 1], test_t *test);
@@ -146,8 +283,18 @@ bool compile_test(cmd_t c[static 1], test_t *t);
 
 bool get_manager(manager_t out[static 1], test_t t[static 1]);
 
+bool prepare_test(test_t *test, prepared_test_t out[static 1]);
+void release_test(prepared_test_t p[static 1]);
+bool quality_measure(test_t *t, manager_t m);
+bool quality_retry(test_t *t, manager_t m);
 bool execute_dependencies(test_t *parent);
+bool execute_dependencies_batched(test_t *parent);
 bool execute_dependency(cmd_t cmd[static 1], test_t *test);
+bool execute_simulation_batch(usize n, const char *names[static n],
+                              run_options_t opts);
+void run_simulation_group(cmd_t c[static 1], usize n, test_t tests[static n],
+                          prepared_test_t prep[static n],
+                          bool pending[static n]);
 
 result_code_t run_user_test(cmd_t *c, test_t *t,
                             struct run_function_request req, manager_t a);
@@ -155,13 +302,42 @@ result_code_t run_kernel_test(cmd_t *c, test_t *t,
                               struct run_function_request req, manager_t a);
 result_code_t run_simulation_test(cmd_t *c, test_t *t,
                                   struct run_function_request req, manager_t a);
+bool run_simulation_bundle(cmd_t c[static 1], usize n, test_t tests[static n],
+                           prepared_test_t prep[static n],
+                           bool pending[static n]);
 result_code_t run_test(cmd_t *c, test_t *t, struct run_function_request r,
                        manager_t a);
 
 void serialize_args(str *out, struct run_function_request req);
-void args_to_c_array(str *out, struct run_function_request req);
+void args_to_c_array(str *out, struct run_function_request req,
+                     const char *prefix);
+void construct_args(str *out, struct run_function_request req,
+                    const char *prefix);
 strv parse_between_delim(u8 *buf, usize buflen, char *delim, usize delim_len);
 
+u64 quiet_machine(cpuid_t cpu);
+void quiet_restore(void);
+void quiet_recover(void);
+bool isolate_setup(cpuid_t cpu, const char *cpus);
+void calibrate(run_options_t *opts);
+void telemetry_begin(cpuid_t cpu);
+void telemetry_end(telemetry_t *out, const char *module_name);
+bool isolate_enter(void);
+void isolate_leave(void);
+void isolate_teardown(void);
+void restore_machine(void);
+void restore_on_exit(void);
+phase_clock_t phase_begin(void);
+void phase_end(test_t *t, phase_t phase, phase_clock_t clock);
+void phase_end_shared(usize n, test_t tests[static n], bool shared[static n],
+                      phase_t phase, phase_clock_t clock);
+void phase_summary(void);
+bool trace_open(const char *path);
+void trace_close(void);
+void trace_process(const char *name);
+void trace_instant(test_t *t, const char *what);
+void trace_result(test_t *t);
+
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
 ///////////////////////////////////////////////////////////////////////////////
@@ -259,12 +435,26 @@ bool test_save(test_t *t, str *sink) {
 
   da_append_many(sink, t->result, t->result_size);
 
+  const usize telemetry_size = sizeof(t->telemetry);
+  serialize_field(sink, telemetry_size);
+  serialize_field(sink, t->telemetry);
+
+  const usize quality_size = sizeof(t->quality);
+  serialize_field(sink, quality_size);
+  serialize_field(sink, t->quality);
+
+  const usize phases_size = sizeof(t->phases);
+  serialize_field(sink, phases_size);
+  serialize_field(sink, t->phases);
+
   return true;
 }
 
 bool save_run(const char *path) {
   str out_file = {};
 
+  const u64 magic = RUN_FILE_MAGIC;
+  da_append_many(&out_file, &magic, sizeof(magic));
   da_append_many(&out_file, &runned_test.count, sizeof(runned_test.count));
 
   da_foreach_s(test_t, t, runned_test) {
@@ -290,6 +480,14 @@ bool load_run(const char *path) {
   }
 
   u8 *ptr = (u8 *)file.items;
+  const bool has_phases = bp_peek_usize(ptr) == RUN_FILE_MAGIC;
+  const bool has_quality =
+      has_phases || bp_peek_usize(ptr) == RUN_FILE_MAGIC_QUALITY;
+  const bool has_telemetry =
+      has_quality || bp_peek_usize(ptr) == RUN_FILE_MAGIC_TELEMETRY;
+  if (has_telemetry)
+    bp_get_usize(&ptr);
+
   int num_tests = bp_get_usize(&ptr);
   plog(INFO, "num tests %d", num_tests);
 
@@ -302,6 +500,25 @@ bool load_run(const char *path) {
     usize result_size = bp_get_usize(&ptr);
     /* plog(INFO, "res_size %d", result_size); */
     void *result = bp_get_bytes(&ptr, result_size);
+    telemetry_t telemetry = {0};
+    if (has_telemetry) {
+      usize telemetry_size = bp_get_usize(&ptr);
+      memcpy(&telemetry, bp_get_bytes(&ptr, telemetry_size),
+             telemetry_size < sizeof(telemetry) ? telemetry_size
+                                                : sizeof(telemetry));
+    }
+    quality_t quality = {0};
+    if (has_quality) {
+      usize quality_size = bp_get_usize(&ptr);
+      memcpy(&quality, bp_get_bytes(&ptr, quality_size),
+             quality_size < sizeof(quality) ? quality_size : sizeof(quality));
+    }
+    phases_t phases = {0};
+    if (has_phases) {
+      usize phases_size = bp_get_usize(&ptr);
+      memcpy(&phases, bp_get_bytes(&ptr, phases_size),
+             phases_size < sizeof(phases) ? phases_size : sizeof(phases));
+    }
     // TODO: SEE FOR SIM
     test_t *t = test_new(
         module_name,
@@ -309,6 +526,9 @@ bool load_run(const char *path) {
 
     t->result_size = result_size;
     t->result_code = result_code;
+    t->telemetry = telemetry;
+    t->quality = quality;
+    t->phases = phases;
 
     t->result = malloc(t->result_size);
     memset(t->result, 0, t->result_size);
@@ -478,8 +698,11 @@ bool get_manager(manager_t out[static 1], test_t t[static 1]) {
   const char *in = tsprintf("./%s_manager.c", t->module_name);
 
   cmd_t c = {0};
+  phase_clock_t clock = phase_begin();
   const char *so = make_shared_lib(&c, in, 1, false, (const char *[]){in});
-  if (!cmd_run_reset(&c)) {
+  const bool built = cmd_run_reset(&c);
+  phase_end(t, PHASE_MANAGER_BUILD, clock);
+  if (!built) {
     plog(ERR, "Failed to compile the shared library %s: %s\n", in,
          strerror(errno));
 
@@ -487,7 +710,9 @@ bool get_manager(manager_t out[static 1], test_t t[static 1]) {
   }
   cmd_free(&c);
 
+  clock = phase_begin();
   out->shlib = dlopen(so, RTLD_LAZY);
+  phase_end(t, PHASE_MANAGER_LOAD, clock);
   if (out->shlib == NULL) {
     plog(ERR, "Failed to open the shared library %s\n", dlerror());
 
@@ -500,6 +725,9 @@ bool get_manager(manager_t out[static 1], test_t t[static 1]) {
       get_func(out->shlib, tsprintf("%s_result_size", t->module_name));
   out->get_result_diagnostics =
       get_func(out->shlib, tsprintf("%s_result_diagnostics", t->module_name));
+  // Not an error when missing, the result is just not gated
+  out->get_result_quality =
+      dlsym(out->shlib, tsprintf("%s_result_quality", t->module_name));
 
   return true;
 }
@@ -626,7 +854,7 @@ bool compile_kernel_module(cmd_t c[static 1], test_t *test) {
 
 bool compile_simulation_module(cmd_t c[static 1], test_t *test) {
   const char *test_dir =
-      tsprintf("%s/tests", test->opts.extra_sim_options.chipyard.directory);
+      sim_tests_dir(&test->opts);
   const char *out_file = tsprintf("%s/test.c", test_dir);
   const char *out_args = tsprintf("%s/args.h.in", test_dir);
 
@@ -642,10 +870,21 @@ bool compile_simulation_module(cmd_t c[static 1], test_t *test) {
   }
   t.count = 0;
 
+  // With checkpoints the arguments are patched in the memory image, so the
+  // binary does not change when they do
+  if (test->opts.extra_sim_options.checkpoint)
+    str_append_cstr(&t, "#define SIM_CHECKPOINT\n");
+  if (test->opts.extra_sim_options.heap_size)
+    str_append_cstr(&t, tsprintf("#define SIM_HEAP_SIZE %zu\n",
+                                 test->opts.extra_sim_options.heap_size));
+  str_append_cstr(&t, tsprintf("#define NUM_HARTS %zu\n",
+                               test->opts.extra_sim_options.harts));
+
   str_append_cstr(&t, tsprintf("#include \"%s/%s/%s/%s.c\"\n", cwd, module_dir,
                                test->module_name, test->test_file));
 
-  str_append_cstr(&t, "#include \"args.h.in\"\n");
+  if (!test->opts.extra_sim_options.checkpoint)
+    str_append_cstr(&t, "#include \"args.h.in\"\n");
 
   da_append(&t, '\0');
 
@@ -655,10 +894,52 @@ bool compile_simulation_module(cmd_t c[static 1], test_t *test) {
   }
   da_free(&t);
 
+  return build_simulation_binary(c, &test->opts);
+}
+
+// Slot 0 builds in the tests directory of chipyard, every other slot has its
+// own copy so that several simulations can be built and run at once
+const char *sim_tests_dir(run_options_t *opts) {
+  const char *chipyard = opts->extra_sim_options.chipyard.directory;
+  if (sim_slot == 0)
+    return tsprintf("%s/tests", chipyard);
+
+  return tsprintf("%s/tests-slot%zu", chipyard, sim_slot);
+}
+
+bool sim_slot_setup(cmd_t c[static 1], run_options_t *opts, usize slot) {
+  const char *chipyard = opts->extra_sim_options.chipyard.directory;
+  const char *dir = tsprintf("tests-slot%zu", slot);
+  if (slot == 0 ||
+      access(tsprintf("%s/%s/Makefile", chipyard, dir), F_OK) == 0)
+    return true;
+
+  // Same configuration as scripts/setup_chipyard.sh, without the build files
+  // and checkpoints of the original
+  plog(INFO, "Creating simulation slot %s", dir);
+  cmd_append(
+      c, "/bin/sh", "-c",
+      tconcat(opts->extra_sim_options.shell, " -c ", "\"source ",
+              tsprintf("%s/env.sh && cd %s && ", chipyard, chipyard),
+              tsprintf("rm -rf %s && cp -r tests %s && cd %s && "
+                       "rm -rf CMakeCache.txt CMakeFiles ckpt && ",
+                       dir, dir, dir),
+              tsprintf("cmake -DCMAKE_C_FLAGS='-I%s/%s -DTARGET_RISCV "
+                       "-DRUNNER_SIMULATION' .",
+                       cwd, include_dir_name),
+              "\"", NULL));
+
+  return cmd_run_reset(c);
+}
+
+bool build_simulation_binary(cmd_t c[static 1], run_options_t *opts) {
+  const char *test_dir =
+      sim_tests_dir(opts);
+
   cmd_append(c, "/bin/sh", "-c",
-             tconcat(test->opts.extra_sim_options.shell, " -c ", "\"source ",
+             tconcat(opts->extra_sim_options.shell, " -c ", "\"source ",
                      tsprintf("%s/env.sh",
-                              test->opts.extra_sim_options.chipyard.directory),
+                              opts->extra_sim_options.chipyard.directory),
                      " && make -C ", test_dir, " test\"", NULL));
 
   if (!cmd_run_reset(c)) {
@@ -675,7 +956,9 @@ result_code_t run_user_test_as_shlib(cmd_t *c, test_t *t,
   const usize s = tsave();
   const char *so = tsprintf("./%s.so", t->module_name);
 
+  phase_clock_t clock = phase_begin();
   void *shlib = dlopen(so, RTLD_LAZY);
+  phase_end(t, PHASE_LOAD, clock);
   if (!shlib) {
     plog(ERR, "Failed to open the shared library %s\n", dlerror());
 
@@ -689,17 +972,32 @@ result_code_t run_user_test_as_shlib(cmd_t *c, test_t *t,
   CPU_ZERO(&mask);
   CPU_SET(t->opts.cpu, &mask);
 
+  // The sampler is started outside of the partition, the cpuset of the
+  // partition has to be there before the pinning
+  clock = phase_begin();
+  telemetry_begin(t->opts.cpu);
+  isolate_enter();
   if (sched_setaffinity(0, sizeof(mask), &mask) == -1) {
     plog(ERR, "Can't set cpu %d: %s", t->opts.cpu, strerror(errno));
+    isolate_leave();
+    telemetry_end(&t->telemetry, t->module_name);
+    phase_end(t, PHASE_RUN, clock);
     return KO;
   }
   tester(RUN_FUNCTION, &req);
+  telemetry_end(&t->telemetry, t->module_name);
+  phase_end(t, PHASE_RUN, clock);
+  isolate_leave();
 
   t->result = req.ret;
+  clock = phase_begin();
   t->result_code = m.get_result_diagnostics(req.ret);
+  phase_end(t, PHASE_DIAGNOSTICS, clock);
   trestore(s);
 
+  clock = phase_begin();
   dlclose(shlib);
+  phase_end(t, PHASE_UNLOAD, clock);
 
   return t->result_code;
 }
@@ -715,21 +1013,36 @@ result_code_t run_user_test_as_exe(cmd_t *c, test_t *t,
     return KO;
   }
 
+  // Only the tester is started inside the partition
   cmd_append(c, tsprintf("./%s", t->module_name), "data.in");
-  if (!cmd_run_async(c, .fdout = NEW_READ_PIPE)) {
+  phase_clock_t clock = phase_begin();
+  telemetry_begin(t->opts.cpu);
+  isolate_enter();
+  bool started = cmd_run_async(c, .fdout = NEW_READ_PIPE);
+  isolate_leave();
+  if (!started) {
     plog(ERR, "Failed to run exe tester for %s", t->module_name);
+    telemetry_end(&t->telemetry, t->module_name);
+    phase_end(t, PHASE_RUN, clock);
     return false;
   }
 
   str cmd_out = {0};
   read_until_close(c->fdout, &cmd_out);
+  if (!cmd_wait(c))
+    plog(ERR, "Exe tester for %s did not exit cleanly", t->module_name);
+  telemetry_end(&t->telemetry, t->module_name);
+  phase_end(t, PHASE_RUN, clock);
+  cmd_reset(c);
 
   const strv parsed = parse_between_delim((u8 *)cmd_out.items, cmd_out.count,
                                           DELIM, strlen(DELIM));
 
   memcpy(req.ret, parsed.items, parsed.count);
   t->result = req.ret;
+  clock = phase_begin();
   t->result_code = m.get_result_diagnostics(req.ret);
+  phase_end(t, PHASE_DIAGNOSTICS, clock);
 
   return t->result_code;
 }
@@ -769,8 +1082,10 @@ bool unload_kernel_module(cmd_t c[static 1], test_t *t) {
 
 result_code_t run_kernel_test(cmd_t *c, test_t *t,
                               struct run_function_request req, manager_t a) {
-
-  if (!load_kernel_module(c, t))
+  phase_clock_t clock = phase_begin();
+  const bool loaded = load_kernel_module(c, t);
+  phase_end(t, PHASE_LOAD, clock);
+  if (!loaded)
     return KO;
 
   int fd;
@@ -780,18 +1095,27 @@ result_code_t run_kernel_test(cmd_t *c, test_t *t,
     goto remove_kmod;
   }
 
+  clock = phase_begin();
+  telemetry_begin(t->opts.cpu);
   int ret = ioctl(fd, RUN_FUNCTION, &req);
+  telemetry_end(&t->telemetry, t->module_name);
+  phase_end(t, PHASE_RUN, clock);
   if (ret < 0) {
     perror("Failed to open ioclt");
     goto close_fd;
   }
 
   t->result = req.ret;
+  clock = phase_begin();
   t->result_code = a.get_result_diagnostics(req.ret);
+  phase_end(t, PHASE_DIAGNOSTICS, clock);
 
   close(fd);
 
-  if (!unload_kernel_module(c, t))
+  clock = phase_begin();
+  const bool unloaded = unload_kernel_module(c, t);
+  phase_end(t, PHASE_UNLOAD, clock);
+  if (!unloaded)
     return KO;
 
   return t->result_code;
@@ -818,15 +1142,16 @@ void serialize_args(str *out, struct run_function_request req) {
   }
 }
 
-void args_to_c_array(str *out, struct run_function_request req) {
+void args_to_c_array(str *out, struct run_function_request req,
+                     const char *prefix) {
   usize check = tsave();
   str args = {0};
   serialize_args(&args, req);
 
   str_append_cstr(
       out,
-      tsprintf("const char __attribute__((aligned(8))) __args[%zu] = {\n    ",
-               args.count));
+      tsprintf("const char __attribute__((aligned(8))) %s__args[%zu] = {\n    ",
+               prefix, args.count));
 
   for (size_t i = 0; i < args.count; i++) {
     str_append_cstr(out, tsprintf("0x%02x", (u8)args.items[i]));
@@ -843,20 +1168,24 @@ void args_to_c_array(str *out, struct run_function_request req) {
   da_free(&args);
 }
 
-void construct_args(str *out, struct run_function_request req) {
+// `prefix` is prepended to every generated symbol so several modules can have
+// their arguments in the same translation unit
+void construct_args(str *out, struct run_function_request req,
+                    const char *prefix) {
   usize check = tsave();
-  args_to_c_array(out, req);
-  str_append_cstr(out, tsprintf("const unsigned int cpu = %d;\n", req.cpu));
+  args_to_c_array(out, req, prefix);
+  str_append_cstr(
+      out, tsprintf("const unsigned int %scpu = %d;\n", prefix, req.cpu));
 
-  str_append_cstr(out, tsprintf("void *args[] = {\n    "));
+  str_append_cstr(out, tsprintf("void *%sargs[] = {\n    ", prefix));
   usize idx = sizeof(req.args_count) + 8; // sizeof(req.cpu); // Misaligned read
   for (int i = 0; i < req.args_count; i++) {
     idx += sizeof(req.args_sizes);
-    str_append_cstr(out, tsprintf("(void *)&__args[%d],\n", idx));
+    str_append_cstr(out,
+                    tsprintf("(void *)&%s__args[%d],\n", prefix, idx));
     idx += req.args_sizes[i];
   }
   str_append_cstr(out, "};\n");
-  da_append(out, '\0');
   trestore(check);
 }
 
@@ -880,6 +1209,311 @@ strv parse_between_delim(u8 *buf, usize buflen, char *delim, usize delim_len) {
   return parsed;
 }
 
+// Bytes of simulator output kept for debugging
+#define SIM_TAIL_SZ (16 * 1024)
+// An open frame bigger than this is not a result, drop it
+#define SIM_FRAME_MAX (1024 * 1024)
+
+// Incremental parser of the simulator output. Closed frames are appended to
+// `frames` still wrapped in DELIM, so parse_between_delim() works on it, the
+// rest of the output only survives in a bounded tail.
+typedef struct {
+  str *frames;
+  usize closed;
+
+  bool inside;
+  str pending;
+  usize scanned;
+
+  str tail;
+} sim_scanner_t;
+
+static void sim_scanner_tail(sim_scanner_t *sc, const char *buf, usize n) {
+  da_append_many(&sc->tail, buf, n);
+  if (sc->tail.count > 2 * SIM_TAIL_SZ) {
+    memmove(sc->tail.items, sc->tail.items + sc->tail.count - SIM_TAIL_SZ,
+            SIM_TAIL_SZ);
+    sc->tail.count = SIM_TAIL_SZ;
+  }
+}
+
+void sim_scanner_feed(sim_scanner_t *sc, const char *buf, usize n) {
+  const usize dlen = strlen(DELIM);
+  da_append_many(&sc->pending, buf, n);
+
+  while (true) {
+    char *p = sc->pending.items;
+    usize count = sc->pending.count;
+    char *d = memmem(p + sc->scanned, count - sc->scanned, DELIM, dlen);
+
+    if (!d) {
+      // Only the last bytes can still be the beginning of a DELIM
+      usize keep = count < dlen - 1 ? count : dlen - 1;
+      if (!sc->inside || count > SIM_FRAME_MAX) {
+        sc->inside = false;
+        sim_scanner_tail(sc, p, count - keep);
+        memmove(p, p + count - keep, keep);
+        sc->pending.count = keep;
+        sc->scanned = 0;
+      } else {
+        sc->scanned = count - keep;
+      }
+      return;
+    }
+
+    usize len = d - p;
+    if (sc->inside) {
+      str_append_cstr(sc->frames, DELIM);
+      da_append_many(sc->frames, p, len);
+      str_append_cstr(sc->frames, DELIM);
+      sc->closed++;
+    } else {
+      sim_scanner_tail(sc, p, len);
+    }
+
+    sc->inside = !sc->inside;
+    memmove(p, d + dlen, count - len - dlen);
+    sc->pending.count = count - len - dlen;
+    sc->scanned = 0;
+  }
+}
+
+// Group of the running simulator, it does not get the terminal's signals
+static volatile pid_t sim_group = 0;
+
+// `image` is loaded in the simulated memory, with `loadarch` the harts start
+// from the architectural state in it instead of from reset. The simulator is
+// stopped as soon as `expected` frames have been received, they are the only
+// part of the output stored in `out`.
+bool run_simulator(cmd_t c[static 1], run_options_t *opts, const char *image,
+                   const char *loadarch, usize expected, str *out) {
+  assert(opts->sim_impl == SIM_CHIPYARD);
+  const char *config = "CustomBoomV3Config";
+  const char *arch = loadarch ? tsprintf("+loadarch=%s ", loadarch) : "";
+  // clang-format off
+  cmd_append(c, "/bin/sh", "-c",
+             tconcat(opts->extra_sim_options.shell,
+                     " -c ", "\"source ",
+                     tsprintf("%s/env.sh && ", opts->extra_sim_options.chipyard.directory),
+                     tsprintf("cd %s && ", opts->extra_sim_options.chipyard.directory),
+                     tsprintf("exec ./sims/verilator/simulator-chipyard.harness-%s "
+                              "+permissive "
+                              "+dramsim "
+                              "+dramsim_ini_dir=generators/testchipip/src/main/resources/dramsim2_ini "
+                              "+fastloadmem "
+                              "+loadmem=%s "
+                              "%s"
+                              "+permissive-off "
+                              "%s \""
+                              , config, image, arch, image), NULL));
+  // clang-format on
+
+  // /bin/sh does not always exec the last command, the whole group has to be
+  // stopped to reach the simulator
+  if (!cmd_run_async(c, .fdout = NEW_READ_PIPE, .new_group = true)) {
+    return false;
+  }
+  sim_group = c->pid;
+
+  sim_scanner_t scanner = {.frames = out};
+  bool stopped = false;
+  char buf[4096];
+  while (true) {
+    ssize_t n = read(c->fdout, buf, sizeof(buf));
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+
+    sim_scanner_feed(&scanner, buf, n);
+    if (expected > 0 && scanner.closed >= expected) {
+      // The rest is only the harness shutting down
+      kill(-c->pid, SIGTERM);
+      stopped = true;
+      break;
+    }
+  }
+
+  if (stopped)
+    waitpid(c->pid, NULL, 0);
+  else
+    cmd_wait(c);
+  cmd_reset(c);
+  sim_group = 0;
+
+  if (!scanner.inside)
+    sim_scanner_tail(&scanner, scanner.pending.items, scanner.pending.count);
+
+  plog(INFO, str_fmt, str_arg(&scanner.tail));
+  if (scanner.closed < expected)
+    plog(ERR, "Simulation ended with %zu of %zu results", scanner.closed,
+         expected);
+
+  da_free(&scanner.pending);
+  da_free(&scanner.tail);
+  return scanner.closed >= expected;
+}
+
+bool sim_symbol_address(cmd_t c[static 1], run_options_t *opts,
+                        const char *binary, const char *symbol,
+                        u64 out[static 1]) {
+  cmd_append(c, "/bin/sh", "-c",
+             tconcat(opts->extra_sim_options.shell, " -c ", "\"source ",
+                     tsprintf("%s/env.sh",
+                              opts->extra_sim_options.chipyard.directory),
+                     " && riscv64-unknown-elf-nm ", binary, "\"", NULL));
+
+  if (!cmd_run_async(c, .fdout = NEW_READ_PIPE))
+    return false;
+
+  str nm = {0};
+  read_until_close(c->fdout, &nm);
+  da_append(&nm, '\0');
+  cmd_wait(c);
+  cmd_reset(c);
+
+  bool found = false;
+  for (char *line = strtok(nm.items, "\n"); line; line = strtok(NULL, "\n")) {
+    char type;
+    char name[256];
+    unsigned long long addr;
+    if (sscanf(line, "%llx %c %255s", &addr, &type, name) == 3 &&
+        strcmp(name, symbol) == 0) {
+      *out = addr;
+      found = true;
+      break;
+    }
+  }
+
+  da_free(&nm);
+  if (!found)
+    plog(ERR, "Symbol %s not found in %s", symbol, binary);
+  return found;
+}
+
+// Writes `data` at the virtual address `addr` of an ELF64 image, the address
+// has to be backed by the file part of a PT_LOAD segment
+bool elf_patch(str *elf, u64 addr, const void *data, usize size) {
+  if (elf->count < sizeof(Elf64_Ehdr))
+    return false;
+
+  Elf64_Ehdr *eh = (Elf64_Ehdr *)elf->items;
+  if (memcmp(eh->e_ident, ELFMAG, SELFMAG) != 0 ||
+      eh->e_ident[EI_CLASS] != ELFCLASS64)
+    return false;
+
+  if (eh->e_phoff + (u64)eh->e_phnum * sizeof(Elf64_Phdr) > elf->count)
+    return false;
+
+  Elf64_Phdr *ph = (Elf64_Phdr *)(elf->items + eh->e_phoff);
+  for (usize i = 0; i < eh->e_phnum; i++) {
+    if (ph[i].p_type != PT_LOAD || addr < ph[i].p_paddr ||
+        addr + size > ph[i].p_paddr + ph[i].p_filesz)
+      continue;
+
+    u64 off = ph[i].p_offset + (addr - ph[i].p_paddr);
+    if (off + size > elf->count)
+      return false;
+
+    memcpy(elf->items + off, data, size);
+    return true;
+  }
+
+  return false;
+}
+
+// Size of __sim_args in simulation_tester.c
+#define SIM_ARGS_SZ (16 * 1024)
+
+// The checkpoint is taken with spike when hart 0 reaches sim_checkpoint(),
+// after the harness has booted. It only depends on the binary, so it is kept
+// next to the tests and reused until the module changes. Every run only
+// patches its arguments in a copy of the memory image.
+bool sim_checkpoint_image(cmd_t c[static 1], test_t *t,
+                          struct run_function_request req,
+                          const char *image[static 1],
+                          const char *loadarch[static 1]) {
+  bool ok = false;
+  run_options_t *opts = &t->opts;
+  const char *chipyard = opts->extra_sim_options.chipyard.directory;
+  const char *binary = tsprintf("%s/test.riscv", sim_tests_dir(opts));
+
+  str bin = {0};
+  str mem = {0};
+  str args = {0};
+  if (!read_file(binary, &bin)) {
+    plog(ERR, "Could not read %s", binary);
+    goto exit;
+  }
+
+  // FNV-1a, of the binary and of the harts spike is started with
+  const usize harts = opts->extra_sim_options.harts;
+  u64 hash = 0xcbf29ce484222325ULL;
+  for (usize i = 0; i < bin.count; i++)
+    hash = (hash ^ (u8)bin.items[i]) * 0x100000001b3ULL;
+  for (usize i = 0; i < sizeof(harts); i++)
+    hash = (hash ^ (u8)(harts >> (8 * i))) * 0x100000001b3ULL;
+
+  const char *ckpt_root = tsprintf("%s/tests/ckpt", chipyard);
+  const char *ckpt =
+      tsprintf("%s/%s-%016llx", ckpt_root, t->module_name, hash);
+  const char *arch = tsprintf("%s/loadarch", ckpt);
+  const char *mem_elf = tsprintf("%s/mem.elf", ckpt);
+
+  if (access(arch, F_OK) != 0) {
+    u64 pc;
+    if (!sim_symbol_address(c, opts, binary, "sim_checkpoint", &pc))
+      goto exit;
+
+    mkdir(ckpt_root, 0755);
+    plog(INFO, "Generating checkpoint for %s at 0x%llx", t->module_name, pc);
+    cmd_append(c, "/bin/sh", "-c",
+               tconcat(opts->extra_sim_options.shell, " -c ", "\"source ",
+                       tsprintf("%s/env.sh && cd %s && ", chipyard, chipyard),
+                       tsprintf("./scripts/generate-ckpt.sh -b %s -n %zu "
+                                "-p 0x%llx -i 0 -o %s",
+                                binary, harts, pc, ckpt),
+                       "\"", NULL));
+    if (!cmd_run_reset(c) || access(arch, F_OK) != 0) {
+      plog(ERR, "Failed to generate the checkpoint in %s", ckpt);
+      goto exit;
+    }
+  }
+
+  u64 args_addr;
+  if (!sim_symbol_address(c, opts, binary, "__sim_args", &args_addr))
+    goto exit;
+
+  serialize_args(&args, req);
+  if (args.count > SIM_ARGS_SZ) {
+    plog(ERR, "Arguments of %s do not fit in __sim_args (%zu > %d)",
+         t->module_name, args.count, SIM_ARGS_SZ);
+    goto exit;
+  }
+
+  if (!read_file(mem_elf, &mem) ||
+      !elf_patch(&mem, args_addr, args.items, args.count)) {
+    plog(ERR, "Could not patch the arguments in %s", mem_elf);
+    goto exit;
+  }
+
+  const char *run_elf = tsprintf("%s/run.elf", ckpt);
+  if (!write_to_file_bin(run_elf, (u8 *)mem.items, mem.count)) {
+    plog(ERR, "Faild to write %s: %s", run_elf, strerror(errno));
+    goto exit;
+  }
+
+  *image = run_elf;
+  *loadarch = arch;
+  ok = true;
+
+exit:
+  da_free(&bin);
+  da_free(&mem);
+  da_free(&args);
+  return ok;
+}
+
 result_code_t run_simulation_test(cmd_t *c, test_t *t,
                                   struct run_function_request req,
                                   manager_t a) {
@@ -887,10 +1521,11 @@ result_code_t run_simulation_test(cmd_t *c, test_t *t,
 
   str out = {0};
 
-  construct_args(&out, req);
+  construct_args(&out, req, "");
+  da_append(&out, '\0');
 
   const char *test_dir =
-      tsprintf("%s/tests", t->opts.extra_sim_options.chipyard.directory);
+      sim_tests_dir(&t->opts);
   const char *out_args = tsprintf("%s/args.h.in", test_dir);
   if (!write_to_file(out_args, out.items)) {
     plog(ERR, "Faild to write %s: %s", out_args, strerror(errno));
@@ -898,53 +1533,196 @@ result_code_t run_simulation_test(cmd_t *c, test_t *t,
   }
   da_free(&out);
 
-  if (!compile_simulation_module(c, t)) {
+  phase_clock_t clock = phase_begin();
+  const bool built = compile_simulation_module(c, t);
+  phase_end(t, PHASE_BUILD, clock);
+  if (!built) {
     return KO;
   }
 
-  assert(t->opts.sim_impl == SIM_CHIPYARD);
-  const char *config = "CustomBoomV3Config";
-  plog(INFO, "%d", c->c.count);
-  // clang-format off
-  cmd_append(c, "/bin/sh", "-c",
-             tconcat(t->opts.extra_sim_options.shell,
-                     " -c ", "\"source ",
-                     tsprintf("%s/env.sh && ", t->opts.extra_sim_options.chipyard.directory),
-                     tsprintf("cd %s && ", t->opts.extra_sim_options.chipyard.directory),
-                     tsprintf("./sims/verilator/simulator-chipyard.harness-%s "
-                              "+permissive "
-                              "+dramsim "
-                              "+dramsim_ini_dir=generators/testchipip/src/main/resources/dramsim2_ini "
-                              "+fastloadmem "
-                              "+loadmem=./tests/test.riscv "
-                              "+permissive-off "
-                              "./tests/test.riscv \""
-                              , config)));
-  // clang-format on
-
-  /* cmd_run_reset(c); */
-  /* exit(0); */
-  if (!cmd_run_async(c, .fdout = NEW_READ_PIPE)) {
-    plog(ERR, "Failed to run simulation for %s", t->module_name);
-    return false;
+  const char *image = tsprintf("%s/test.riscv", test_dir);
+  const char *loadarch = NULL;
+  clock = phase_begin();
+  if (t->opts.extra_sim_options.checkpoint &&
+      !sim_checkpoint_image(c, t, req, &image, &loadarch)) {
+    plog(WARN, "No checkpoint for %s, booting from reset", t->module_name);
+    image = tsprintf("%s/test.riscv", test_dir);
+    loadarch = NULL;
   }
+  phase_end(t, PHASE_LOAD, clock);
 
   str cmd_out = {0};
-  read_until_close(c->fdout, &cmd_out);
-
-  plog(INFO, str_fmt, str_arg(&cmd_out));
+  clock = phase_begin();
+  const bool ran = run_simulator(c, &t->opts, image, loadarch, 1, &cmd_out);
+  phase_end(t, PHASE_RUN, clock);
+  if (!ran) {
+    plog(ERR, "Failed to run simulation for %s", t->module_name);
+    return KO;
+  }
 
   const strv parsed = parse_between_delim((u8 *)cmd_out.items, cmd_out.count,
                                           DELIM, strlen(DELIM));
 
   memcpy(req.ret, parsed.items, parsed.count);
   t->result = req.ret;
+  clock = phase_begin();
   t->result_code = a.get_result_diagnostics(req.ret);
+  phase_end(t, PHASE_DIAGNOSTICS, clock);
 
+  da_free(&cmd_out);
   trestore(check);
   return t->result_code;
 }
 
+bool run_simulation_bundle(cmd_t c[static 1], usize n, test_t tests[static n],
+                           prepared_test_t prep[static n],
+                           bool pending[static n]) {
+  usize check = tsave();
+  run_options_t *opts = &tests[0].opts;
+
+  const char *test_dir =
+      sim_tests_dir(opts);
+  const char *out_file = tsprintf("%s/test.c", test_dir);
+
+  // Every module gets its own prefix for the symbols the testers share, the
+  // rest of their globals must not collide
+  str src = {0};
+  str entries = {0};
+  str_append_cstr(&src, "#define SIM_BUNDLE\n");
+  if (opts->extra_sim_options.heap_size)
+    str_append_cstr(&src, tsprintf("#define SIM_HEAP_SIZE %zu\n",
+                                   opts->extra_sim_options.heap_size));
+  str_append_cstr(&src, tsprintf("#define NUM_HARTS %zu\n",
+                                 opts->extra_sim_options.harts));
+  for (usize i = 0; i < n; i++) {
+    if (!pending[i])
+      continue;
+
+    const char *name = tests[i].module_name;
+    const char *p = tsprintf("__bundle_%s_", name);
+
+    str_append_cstr(&src, tsprintf("\n#define func %sfunc\n"
+                                   "#define RESULT %sRESULT\n"
+                                   "#define result_t %sresult_t\n",
+                                   p, p, p));
+    str_append_cstr(&src, tsprintf("#include \"%s/%s/%s/%s.c\"\n", cwd,
+                                   module_dir, name, tests[i].test_file));
+    str_append_cstr(&src, "#undef func\n#undef RESULT\n#undef result_t\n");
+
+    construct_args(&src, prep[i].req, p);
+
+    str_append_cstr(&src,
+                    tsprintf("static void %srun(void) {\n"
+                             "  %sRESULT = calloc(1, sizeof(*%sRESULT));\n"
+                             "  rand_init_run("
+                             "((calibration_t *)%sargs[0])->seed, \"%s\");\n"
+                             "  %sfunc(%sargs);\n"
+                             "  sim_bundle_frame(\"%s\", %sRESULT, "
+                             "sizeof(*%sRESULT));\n"
+                             "}\n",
+                             p, p, p, p, name, p, p, name, p, p));
+    str_append_cstr(&entries, tsprintf("    {\"%s\", %srun},\n", name, p));
+  }
+
+  str_append_cstr(&src, "\nconst struct sim_bundle_entry sim_bundle[] = {\n");
+  da_append_many(&src, entries.items, entries.count);
+  str_append_cstr(&src, "};\n");
+
+  usize bundled = 0;
+  for (usize i = 0; i < n; i++)
+    bundled += pending[i];
+  str_append_cstr(
+      &src, tsprintf("const usize sim_bundle_count = %zu;\n", bundled));
+  da_append(&src, '\0');
+  da_free(&entries);
+
+  if (!write_to_file(out_file, src.items)) {
+    plog(ERR, "Faild to write %s: %s", out_file, strerror(errno));
+    da_free(&src);
+    trestore(check);
+    return false;
+  }
+  da_free(&src);
+
+  // One binary for the whole bundle, its time is split between the modules
+  phase_clock_t clock = phase_begin();
+  const bool built = build_simulation_binary(c, opts);
+  phase_end_shared(n, tests, pending, PHASE_BUILD, clock);
+  if (!built) {
+    trestore(check);
+    return false;
+  }
+
+  str cmd_out = {0};
+  clock = phase_begin();
+  if (!run_simulator(c, opts, tsprintf("%s/test.riscv", test_dir), NULL,
+                     bundled, &cmd_out)) {
+    plog(ERR, "Failed to run the simulation bundle");
+    cmd_out.count = 0;
+  }
+  phase_end_shared(n, tests, pending, PHASE_RUN, clock);
+
+  // Split the frames back into the results of every module
+  u8 *cur = (u8 *)cmd_out.items;
+  usize remaining = cmd_out.count;
+  while (remaining > 0) {
+    const strv frame = parse_between_delim(cur, remaining, DELIM, strlen(DELIM));
+    if (!frame.items)
+      break;
+
+    const char *name_end = memchr(frame.items, '\0', frame.count);
+    if (name_end) {
+      const usize name_len = name_end - frame.items;
+      const u8 *payload = (u8 *)name_end + 1;
+      const usize payload_len = frame.count - name_len - 1;
+
+      for (usize i = 0; i < n; i++) {
+        test_t *t = &tests[i];
+        if (!pending[i] || strlen(t->module_name) != name_len ||
+            memcmp(t->module_name, frame.items, name_len) != 0)
+          continue;
+
+        if (payload_len != t->result_size) {
+          plog(ERR, "Result of %s has size %zu, expected %zu", t->module_name,
+               payload_len, t->result_size);
+          t->result_code = KO;
+        } else {
+          memcpy(t->result, payload, payload_len);
+          clock = phase_begin();
+          t->result_code = prep[i].manager.get_result_diagnostics(t->result);
+          phase_end(t, PHASE_DIAGNOSTICS, clock);
+          trace_result(t);
+          // Scored only, measuring again would take the whole bundle
+          if (t->result_code != RETRY)
+            quality_measure(t, prep[i].manager);
+        }
+
+        if (t->result_code != RETRY)
+          pending[i] = false;
+        break;
+      }
+    }
+
+    const u8 *next = (u8 *)frame.items + frame.count + strlen(DELIM);
+    remaining -= next - cur;
+    cur = (u8 *)next;
+  }
+
+  // No frame means the module never finished
+  for (usize i = 0; i < n; i++) {
+    if (pending[i] && tests[i].result_code != RETRY) {
+      plog(ERR, "No result from %s in the simulation bundle",
+           tests[i].module_name);
+      tests[i].result_code = KO;
+      pending[i] = false;
+    }
+  }
+
+  da_free(&cmd_out);
+  trestore(check);
+  return true;
+}
+
 result_code_t run_test(cmd_t *c, test_t *t, struct run_function_request r,
                        manager_t a) {
   static_assert(RUNNER_NUM == 3, "Update run test");
@@ -971,47 +1749,31 @@ bool compile_test(cmd_t c[static 1], test_t *t) {
   return __compile_module[t->opts.runner](c, t);
 }
 
-bool execute_dependency(cmd_t c[static 1], test_t *test) {
-  if (chdir(test->module_path) != 0) {
-    plog(ERR, "Failed to change directory: %p", test->module_path);
-    return false;
-  }
-
-  if (test->depends_on.count > 0ULL) {
-    if (chdir(cwd)) {
-      plog(ERR, "Failed to change directory: %p", cwd);
-      return false;
-    };
-
-    if (!execute_dependencies(test)) {
-      // When mitigating the features we still want to test stuff, so we can't
-      // stop just because a test is failing
-      if (!test->mitigate) {
-        return false;
-      }
-    }
-
-    if (chdir(test->module_path) != 0) {
-      plog(ERR, "Failed to change directory: %p", test->module_path);
-      return false;
-    }
-  }
-
+bool prepare_test(test_t *test, prepared_test_t out[static 1]) {
   const char *test_define_name =
       tsprintf(test_define_name_templ, test->module_name, test->module_name);
   if (!write_to_file("test_name.h.out", test_define_name)) {
     plog(ERR, "Failed to write file: %s", strerror(errno));
+    test->result_code = KO;
     return false;
   }
 
-  u64 *local_clock = malloc(sizeof(u64));
-  *local_clock = test->opts.clock_speed;
+  // Every test gets its own copy, the managers rescale the budget
+  calibration_t *local_calibration = malloc(sizeof(*local_calibration));
+  *local_calibration = calibration;
 
   size_t total_args = test->depends_on.count + 1;
   request_dependencies_t *args = malloc(sizeof(*args) * total_args);
   usize *args_sizes = malloc(sizeof(*args_sizes) * total_args);
-  args[0] = (request_dependencies_t)local_clock;
-  args_sizes[0] = sizeof(u64);
+  args[0] = (request_dependencies_t)local_calibration;
+  args_sizes[0] = sizeof(*local_calibration);
+
+  out->req = (struct run_function_request){
+      .args_count = total_args,
+      .args = args,
+      .args_sizes = args_sizes,
+      .cpu = test->opts.cpu,
+  };
 
   bool dep_failed = false;
   for (size_t i = 0; i < test->depends_on.count; i++) {
@@ -1031,107 +1793,1617 @@ bool execute_dependency(cmd_t c[static 1], test_t *test) {
 
   usize tmp_save = tsave();
 
-  manager_t manager = {0};
   volatile result_code_t r = RETRY;
   do {
-    if (!get_manager(&manager, test)) {
+    if (!get_manager(&out->manager, test)) {
       trestore(tmp_save);
+      test->result_code = KO;
       return false;
     }
 
-    r = manager.setup(args);
+    r = out->manager.setup(args);
     if (r == RETRY) {
-      dlclose(manager.shlib);
+      dlclose(out->manager.shlib);
     }
 
   } while (r == RETRY);
 
   if (r == KO) {
     trestore(tmp_save);
+    test->result_code = KO;
     return false;
   }
 
   trestore(tmp_save);
 
-  test->result_size = manager.get_result_size();
+  test->result_size = out->manager.get_result_size();
   test->result = malloc(test->result_size);
   memset(test->result, 0, test->result_size);
+  out->req.ret = test->result;
 
   // Make sure we still allocate stuff to not crash, and exit early BUT
   // When mitigating the features we still want to test stuff, so we can't
   // stop just because a test is failing
   if (dep_failed && !test->mitigate) {
     test->result_code = KO;
-    goto exit;
+    return false;
   }
-  struct run_function_request req = {
-      .args_count = total_args,
-      .args = args,
-      .args_sizes = args_sizes,
-      .cpu = test->opts.cpu,
-      .ret = test->result,
-  };
-
-  plog(INFO, "Begin execution for %s", test->module_name);
-  do {
-    if (!compile_test(c, test)) {
-      plog(ERR, "Failed to compile the test... exiting");
-      goto exit;
-    }
 
-    test->result_code = run_test(c, test, req, manager);
-  } while (test->result_code == RETRY);
+  return true;
+}
 
-exit:
-  free(args[0]);
-  free(args);
-  free(args_sizes);
-  cmd_reset(c);
+void release_test(prepared_test_t p[static 1]) {
+  if (p->req.args) {
+    free(p->req.args[0]);
+    free(p->req.args);
+    free(p->req.args_sizes);
+  }
 
-  if (chdir(cwd)) {
-    plog(ERR, "Failed to change directory: %p", cwd);
-    return false;
-  };
+  if (p->manager.shlib)
+    dlclose(p->manager.shlib);
 
-  dlclose(manager.shlib);
-  return test->result_code == OK;
+  memset(p, 0, sizeof(*p));
 }
 
-bool execute_dependencies(test_t *parent) {
-  cmd_t cmd = {0};
-  usize check = 0;
+// Scores the result with the quality metric of its manager, true when it can
+// be kept
+bool quality_measure(test_t *t, manager_t m) {
+  t->quality.attempts++;
+  if (!m.get_result_quality) {
+    t->quality.status = QUALITY_UNGATED;
+    return true;
+  }
 
-  for (usize i = 0; i < parent->depends_on.count; i++) {
-    test_t *t = test_find(parent->depends_on.items[i], parent->opts.target,
-                          parent->opts.runner, parent->opts.cpu);
+  const bool passed = m.get_result_quality(t->result, &t->quality.value);
+  t->quality.status = passed ? QUALITY_PASSED : QUALITY_FAILED;
+  return passed;
+}
 
-    if (t == NULL) {
+// True when the result just measured is too noisy and the test has to run
+// again. The wait before doing so doubles at every attempt, so a disturbance
+// that lasts a while is not sampled over and over.
+bool quality_retry(test_t *t, manager_t m) {
+  // The manager asked for it already, it starts over from the compilation
+  if (t->result_code == RETRY)
+    return false;
+
+  if (quality_measure(t, m))
+    return false;
+
+  if (t->quality.attempts >= t->opts.quality_attempts) {
+    plog(WARN, "%s did not pass its quality gate after %u attempts (%f)",
+         t->module_name, t->quality.attempts, t->quality.value);
+    return false;
+  }
+
+  u64 backoff = (u64)QUALITY_BACKOFF_MS << (t->quality.attempts - 1);
+  if (backoff > QUALITY_MAX_BACKOFF_MS)
+    backoff = QUALITY_MAX_BACKOFF_MS;
+
+  plog(INFO, "%s failed its quality gate (%f), measuring again in %llu ms",
+       t->module_name, t->quality.value, backoff);
+  trace_instant(t, "noisy");
+  phase_clock_t clock = phase_begin();
+  usleep(backoff * 1000);
+  phase_end(t, PHASE_BACKOFF, clock);
+
+  // The testers accumulate in the result
+  memset(t->result, 0, t->result_size);
+  return true;
+}
+
+bool execute_dependency(cmd_t c[static 1], test_t *test) {
+  if (chdir(test->module_path) != 0) {
+    plog(ERR, "Failed to change directory: %p", test->module_path);
+    return false;
+  }
+
+  if (test->depends_on.count > 0ULL) {
+    if (chdir(cwd)) {
+      plog(ERR, "Failed to change directory: %p", cwd);
+      return false;
+    };
+
+    phase_clock_t clock = phase_begin();
+    const bool deps_ok = execute_dependencies(test);
+    phase_end(test, PHASE_DEPENDENCIES, clock);
+    if (!deps_ok) {
+      // When mitigating the features we still want to test stuff, so we can't
+      // stop just because a test is failing
+      if (!test->mitigate) {
+        return false;
+      }
+    }
+
+    if (chdir(test->module_path) != 0) {
+      plog(ERR, "Failed to change directory: %p", test->module_path);
+      return false;
+    }
+  }
+
+  prepared_test_t p = {0};
+  if (prepare_test(test, &p)) {
+    plog(INFO, "Begin execution for %s", test->module_name);
+    do {
+      phase_clock_t clock = phase_begin();
+      const bool built = compile_test(c, test);
+      phase_end(test, PHASE_BUILD, clock);
+      if (!built) {
+        plog(ERR, "Failed to compile the test... exiting");
+        break;
+      }
+
+      // A noisy result is measured again without building the test again
+      do {
+        test->result_code = run_test(c, test, p.req, p.manager);
+        trace_result(test);
+      } while (quality_retry(test, p.manager));
+    } while (test->result_code == RETRY);
+  }
+
+  release_test(&p);
+  cmd_reset(c);
+
+  if (chdir(cwd)) {
+    plog(ERR, "Failed to change directory: %p", cwd);
+    return false;
+  };
+
+  return test->result_code == OK;
+}
+
+bool execute_dependencies(test_t *parent) {
+  if (parent->opts.runner == RUNNER_SIMULATION &&
+      (parent->opts.extra_sim_options.bundle > 1 ||
+       parent->opts.extra_sim_options.slots > 1)) {
+    return execute_dependencies_batched(parent);
+  }
+
+  cmd_t cmd = {0};
+  usize check = 0;
+
+  for (usize i = 0; i < parent->depends_on.count; i++) {
+    test_t *t = test_find(parent->depends_on.items[i], parent->opts.target,
+                          parent->opts.runner, parent->opts.cpu);
+
+    if (t == NULL) {
       t = test_new(parent->depends_on.items[i], parent->opts);
 
-      check = tsave();
-      if (t == NULL)
-        goto fail;
+      check = tsave();
+      if (t == NULL)
+        goto fail;
+
+      // Don't care if it actually failed, make the full graph
+      execute_dependency(&cmd, t);
+
+      trestore(check);
+    }
+  }
+
+  cmd_free(&cmd);
+  return true;
+
+fail:
+
+  trestore(check);
+  cmd_free(&cmd);
+  return false;
+}
+
+bool execute_dependencies_batched(test_t *parent) {
+  da(const char *) ready = {0};
+  bool ok = true;
+
+  for (usize i = 0; i < parent->depends_on.count; i++) {
+    const char *name = parent->depends_on.items[i];
+    if (test_find(name, parent->opts.target, parent->opts.runner,
+                  parent->opts.cpu))
+      continue;
+
+    // Only read the config, the test is registered when it actually runs
+    test_t dep = {.module_name = name, .opts = parent->opts};
+    if (!get_config_for_module(&dep)) {
+      plog(ERR, "Could not get config for %s", name);
+      ok = false;
+      continue;
+    }
+
+    if (!execute_dependencies_batched(&dep))
+      ok = false;
+    test_free(&dep);
+
+    bool queued = false;
+    da_foreach(const char *, r, &ready) { queued |= strcmp(*r, name) == 0; }
+    if (!queued)
+      da_append(&ready, name);
+  }
+
+  // Every slot gets up to a bundle of modules
+  const usize batch_size = parent->opts.extra_sim_options.bundle *
+                           parent->opts.extra_sim_options.slots;
+
+  // A sibling may have pulled some of them in already
+  da(const char *) batch = {0};
+  for (usize i = 0; i < ready.count; i++) {
+    if (test_find(ready.items[i], parent->opts.target, parent->opts.runner,
+                  parent->opts.cpu))
+      continue;
+
+    da_append(&batch, ready.items[i]);
+    if (batch.count == batch_size) {
+      ok &= execute_simulation_batch(batch.count, batch.items, parent->opts);
+      batch.count = 0;
+    }
+  }
+  if (batch.count > 0)
+    ok &= execute_simulation_batch(batch.count, batch.items, parent->opts);
+
+  da_free(&batch);
+  da_free(&ready);
+  return ok;
+}
+
+bool execute_simulation_batch(usize n, const char *names[static n],
+                              run_options_t opts) {
+  cmd_t cmd = {0};
+
+  usize first = runned_test.count;
+  for (usize i = 0; i < n; i++) {
+    if (!test_new(names[i], opts))
+      plog(ERR, "Could not create the test for %s", names[i]);
+  }
+
+  // No test is added from here on, so the pointers stay valid
+  usize count = runned_test.count - first;
+  test_t *tests = &runned_test.items[first];
+  prepared_test_t *prep = calloc(count, sizeof(*prep));
+  bool *pending = calloc(count, sizeof(*pending));
+  bool ok = true;
+
+  for (usize i = 0; i < count; i++) {
+    if (chdir(tests[i].module_path) != 0) {
+      plog(ERR, "Failed to change directory: %s", tests[i].module_path);
+      tests[i].result_code = KO;
+      continue;
+    }
+
+    pending[i] = prepare_test(&tests[i], &prep[i]);
+
+    if (chdir(cwd)) {
+      plog(ERR, "Failed to change directory: %s", cwd);
+      ok = false;
+      goto cleanup;
+    }
+  }
+
+  const usize group = opts.extra_sim_options.bundle;
+  const usize groups = (count + group - 1) / group;
+
+  if (groups <= 1) {
+    run_simulation_group(&cmd, count, tests, prep, pending);
+  } else {
+    // Every group runs in its own slot from a child process, which sends back
+    // the result code and the result struct of each of its tests
+    pid_t *pids = calloc(groups, sizeof(*pids));
+    fd *pipes = calloc(groups, sizeof(*pipes));
+
+    for (usize g = 0; g < groups; g++) {
+      pids[g] = -1;
+      if (!sim_slot_setup(&cmd, &opts, g))
+        continue;
+
+      fd p[2];
+      if (pipe(p) != 0) {
+        plog(ERR, "Failed to create pipe: %s", strerror(errno));
+        continue;
+      }
+
+      const usize from = g * group;
+      const usize to = from + group < count ? from + group : count;
+
+      fflush(NULL);
+      pids[g] = fork();
+      if (pids[g] == 0) {
+        close(p[0]);
+        sim_slot = g;
+        trace_process(tsprintf("simulation slot %zu", g));
+        cmd_t child_cmd = {0};
+        run_simulation_group(&child_cmd, to - from, &tests[from], &prep[from],
+                             &pending[from]);
+
+        // Every test has the fixed fields, the result struct follows only
+        // if the test has one
+        for (usize i = from; i < to; i++) {
+          s32 code = tests[i].result_code;
+          write(p[1], &code, sizeof(code));
+          write(p[1], &tests[i].quality, sizeof(tests[i].quality));
+          write(p[1], &tests[i].phases, sizeof(tests[i].phases));
+          if (tests[i].result)
+            write(p[1], tests[i].result, tests[i].result_size);
+        }
+        fflush(NULL);
+        _exit(0);
+      }
+
+      close(p[1]);
+      if (pids[g] < 0) {
+        plog(ERR, "Failed to fork slot %zu: %s", g, strerror(errno));
+        close(p[0]);
+        continue;
+      }
+      pipes[g] = p[0];
+    }
+
+    for (usize g = 0; g < groups; g++) {
+      const usize from = g * group;
+      const usize to = from + group < count ? from + group : count;
+
+      str out = {0};
+      if (pids[g] > 0) {
+        read_until_close(pipes[g], &out);
+        close(pipes[g]);
+        waitpid(pids[g], NULL, 0);
+      }
+
+      usize off = 0;
+      for (usize i = from; i < to; i++) {
+        pending[i] = false;
+
+        s32 code;
+        const usize payload = tests[i].result ? tests[i].result_size : 0;
+        if (off + sizeof(code) + sizeof(tests[i].quality) +
+                sizeof(tests[i].phases) + payload >
+            out.count) {
+          plog(ERR, "Slot %zu did not report %s", g, tests[i].module_name);
+          tests[i].result_code = KO;
+          // The records after a short one can't be located
+          off = out.count;
+          continue;
+        }
+
+        memcpy(&code, out.items + off, sizeof(code));
+        off += sizeof(code);
+        memcpy(&tests[i].quality, out.items + off, sizeof(tests[i].quality));
+        off += sizeof(tests[i].quality);
+        memcpy(&tests[i].phases, out.items + off, sizeof(tests[i].phases));
+        off += sizeof(tests[i].phases);
+        if (payload)
+          memcpy(tests[i].result, out.items + off, payload);
+        off += payload;
+        tests[i].result_code = code;
+      }
+      da_free(&out);
+    }
+
+    free(pids);
+    free(pipes);
+  }
+
+  for (usize i = 0; i < count; i++)
+    ok &= tests[i].result_code == OK;
+
+cleanup:
+  for (usize i = 0; i < count; i++)
+    release_test(&prep[i]);
+
+  free(prep);
+  free(pending);
+  cmd_free(&cmd);
+  return ok;
+}
+
+// Runs the pending tests in the current slot, bundled if possible
+void run_simulation_group(cmd_t c[static 1], usize n, test_t tests[static n],
+                          prepared_test_t prep[static n],
+                          bool pending[static n]) {
+  bool bundled = n > 1 && tests[0].opts.extra_sim_options.bundle > 1;
+  for (usize left = n; left > 0;) {
+    if (bundled) {
+      plog(INFO, "Begin bundled execution of %zu modules", left);
+      if (!run_simulation_bundle(c, n, tests, prep, pending)) {
+        plog(WARN, "Could not bundle the modules, running them one by one");
+        bundled = false;
+      }
+    }
+
+    if (!bundled) {
+      for (usize i = 0; i < n; i++) {
+        if (!pending[i])
+          continue;
+
+        plog(INFO, "Begin execution for %s", tests[i].module_name);
+        do {
+          tests[i].result_code =
+              run_test(c, &tests[i], prep[i].req, prep[i].manager);
+          trace_result(&tests[i]);
+        } while (tests[i].result_code == RETRY ||
+                 quality_retry(&tests[i], prep[i].manager));
+        pending[i] = false;
+      }
+    }
+
+    left = 0;
+    for (usize i = 0; i < n; i++)
+      left += pending[i];
+  }
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Calibration
+//
+// The TSC is timed against CLOCK_MONOTONIC_RAW while the test CPU spins, the
+// core cycles of the same window come from APERF/MPERF or, without the msr
+// driver, from a perf counter. Every round is short and the median is kept,
+// so a turbo that moves during the calibration does not skew it.
+///////////////////////////////////////////////////////////////////////////////
+
+#define CALIBRATION_ROUNDS 7
+#define CALIBRATION_WARMUP_NS (50 * 1000 * 1000ULL)
+#define CALIBRATION_ROUND_NS (20 * 1000 * 1000ULL)
+
+#define MSR_MPERF 0xe7
+#define MSR_APERF 0xe8
+
+static u64 monotonic_ns(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static u64 calibration_tsc(void) {
+#ifdef __x86_64__
+  u32 lo, hi;
+  __asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+  return ((u64)hi << 32) | lo;
+#else
+  return 0;
+#endif
+}
+
+static void calibration_spin(u64 ns) {
+  volatile u64 sink = 0;
+  const u64 start = monotonic_ns();
+  while (monotonic_ns() - start < ns) {
+    for (u64 i = 0; i < 1000; i++)
+      sink += i;
+  }
+}
+
+static bool calibration_msr(int msr, u64 out[static 2]) {
+  return pread(msr, &out[0], sizeof(u64), MSR_APERF) == sizeof(u64) &&
+         pread(msr, &out[1], sizeof(u64), MSR_MPERF) == sizeof(u64);
+}
+
+static int u64_cmp(const void *a, const void *b) {
+  const u64 x = *(const u64 *)a, y = *(const u64 *)b;
+  return (x > y) - (x < y);
+}
+
+static u64 median_u64(usize n, u64 v[static n]) {
+  qsort(v, n, sizeof(*v), u64_cmp);
+  return v[n / 2];
+}
+
+// Fills `calibration`, measured on `cpu` unless the clock was given
+void calibrate(run_options_t *opts) {
+  calibration = (calibration_t){
+      .budget = CALIBRATION_DEFAULT_HZ,
+      .tsc_hz = CALIBRATION_DEFAULT_HZ,
+      .core_hz = CALIBRATION_DEFAULT_HZ,
+      .tsc_per_core = FP_SCALE,
+      .source = CALIBRATION_NONE,
+  };
+
+  // The cycle counter of a simulated core is the core clock
+  if (opts->clock_speed || opts->runner == RUNNER_SIMULATION) {
+    if (opts->clock_speed) {
+      calibration.budget = calibration.tsc_hz = calibration.core_hz =
+          opts->clock_speed;
+    }
+    calibration.source = CALIBRATION_FIXED;
+    goto done;
+  }
+
+  if (!calibration_tsc()) {
+    plog(WARN, "No TSC on this host, calibration skipped");
+    goto done;
+  }
+
+  cpu_set_t old, pin;
+  sched_getaffinity(0, sizeof(old), &old);
+  CPU_ZERO(&pin);
+  CPU_SET(opts->cpu, &pin);
+  // Measured anywhere else it would describe another core
+  if (sched_setaffinity(0, sizeof(pin), &pin) != 0) {
+    plog(WARN, "Can't calibrate on cpu %d, calibration skipped: %s",
+         opts->cpu, strerror(errno));
+    goto done;
+  }
+
+  int msr = open(tsprintf("/dev/cpu/%d/msr", opts->cpu), O_RDONLY);
+  int perf = -1;
+  if (msr < 0) {
+    struct perf_event_attr attr = {
+        .type = PERF_TYPE_HARDWARE,
+        .size = sizeof(attr),
+        .config = PERF_COUNT_HW_CPU_CYCLES,
+    };
+    perf = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+  }
+
+  u64 tsc_hz[CALIBRATION_ROUNDS], core_hz[CALIBRATION_ROUNDS];
+  usize core_rounds = 0;
+
+  calibration_spin(CALIBRATION_WARMUP_NS);
+  for (usize r = 0; r < CALIBRATION_ROUNDS; r++) {
+    u64 m0[2] = {0}, m1[2] = {0}, c0 = 0, c1 = 0;
+    bool has_core = msr >= 0 ? calibration_msr(msr, m0)
+                             : perf >= 0 && read(perf, &c0, sizeof(c0)) ==
+                                                sizeof(c0);
+    const u64 t0 = monotonic_ns(), tsc0 = calibration_tsc();
+
+    calibration_spin(CALIBRATION_ROUND_NS);
+
+    const u64 tsc1 = calibration_tsc(), t1 = monotonic_ns();
+    has_core &= msr >= 0 ? calibration_msr(msr, m1)
+                         : read(perf, &c1, sizeof(c1)) == sizeof(c1);
+
+    tsc_hz[r] = (tsc1 - tsc0) * 1000000000ULL / (t1 - t0);
+    if (has_core && msr >= 0 && m1[1] > m0[1]) {
+      // MPERF ticks at the TSC rate
+      core_hz[core_rounds++] =
+          (u64)((double)tsc_hz[r] * (m1[0] - m0[0]) / (m1[1] - m0[1]));
+    } else if (has_core && msr < 0 && c1 > c0) {
+      core_hz[core_rounds++] = (c1 - c0) * 1000000000ULL / (t1 - t0);
+    }
+  }
+
+  calibration.tsc_hz = median_u64(CALIBRATION_ROUNDS, tsc_hz);
+  calibration.core_hz = calibration.tsc_hz;
+  calibration.source = CALIBRATION_TSC;
+  if (core_rounds == CALIBRATION_ROUNDS) {
+    calibration.core_hz = median_u64(core_rounds, core_hz);
+    calibration.source = msr >= 0 ? CALIBRATION_MSR : CALIBRATION_PERF;
+  } else {
+    plog(WARN, "No APERF/MPERF or perf cycles, the core is assumed to run at "
+               "the TSC rate");
+  }
+  calibration.tsc_per_core =
+      ((u64)calibration.tsc_hz << FP_SHIFT) / calibration.core_hz;
+  calibration.budget = calibration.core_hz;
+
+  if (msr >= 0)
+    close(msr);
+  if (perf >= 0)
+    close(perf);
+  sched_setaffinity(0, sizeof(old), &old);
+
+done:
+  plog(INFO, "tsc %llu Hz, core %llu Hz, %.3f tsc ticks per core cycle",
+       calibration.tsc_hz, calibration.core_hz,
+       (double)calibration.tsc_per_core / FP_SCALE);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// --quiet-machine
+//
+// Every setting is saved right before it is changed: in memory for the exit
+// and signal paths and in a journal for when the orchestrator dies without
+// running them. A journal left behind is replayed by the next start.
+///////////////////////////////////////////////////////////////////////////////
+
+// In the directory the orchestrator started from, it moves into the modules
+#define QUIET_JOURNAL ".quiet-machine.journal"
+#define QUIET_MAX_SAVED 4096
+#define QUIET_SYSFS_CPU "/sys/devices/system/cpu"
+
+struct quiet_saved {
+  pid_t pid; // Affinity of a kernel thread when not 0, otherwise a file
+  char path[128];
+  char value[256];
+};
+
+static struct quiet_saved quiet_saved[QUIET_MAX_SAVED];
+static volatile usize quiet_saved_count = 0;
+static pid_t restore_owner = 0;
+static int quiet_journal = -1;
+static char quiet_journal_path[PATH_MAX] = {0};
+static int quiet_dma_latency = -1;
+
+// Absolute, the signal handlers unlink it from whatever directory the
+// current test left the orchestrator in
+static const char *quiet_journal_file(void) {
+  if (!quiet_journal_path[0])
+    snprintf(quiet_journal_path, sizeof(quiet_journal_path), "%s/%s", cwd,
+             QUIET_JOURNAL);
+  return quiet_journal_path;
+}
+
+static bool quiet_read(const char *path, char *buf, usize size) {
+  int f = open(path, O_RDONLY);
+  if (f < 0)
+    return false;
+
+  ssize n = read(f, buf, size - 1);
+  close(f);
+  if (n < 0)
+    return false;
+
+  while (n > 0 && (buf[n - 1] == '\n' || buf[n - 1] == ' '))
+    n--;
+  buf[n] = '\0';
+  return true;
+}
+
+// No stdio and no allocations, it also runs from the signal handlers
+static bool quiet_write(const char *path, const char *value) {
+  int f = open(path, O_WRONLY);
+  if (f < 0)
+    return false;
+
+  usize len = strlen(value);
+  bool ok = write(f, value, len) == (ssize)len;
+  return close(f) == 0 && ok;
+}
+
+// Start time of a task in clock ticks since boot, with its pid it tells the
+// task apart from a later one that reused the pid
+static bool quiet_task_start(pid_t pid, u64 *start) {
+  char buf[512];
+  if (!quiet_read(tsprintf("/proc/%d/stat", pid), buf, sizeof(buf)))
+    return false;
+
+  // The comm in field 2 may hold spaces, the fields are counted after it
+  char *p = strrchr(buf, ')');
+  for (int field = 2; p && field < 22; field++)
+    p = strchr(p + 1, ' ');
+  if (!p)
+    return false;
+
+  *start = strtoull(p + 1, NULL, 10);
+  return true;
+}
+
+static bool cpulist_parse(const char *list, cpu_set_t *set) {
+  CPU_ZERO(set);
+  while (*list) {
+    char *end;
+    unsigned long from = strtoul(list, &end, 10);
+    if (end == list)
+      return false;
+
+    unsigned long to = from;
+    if (*end == '-')
+      to = strtoul(end + 1, &end, 10);
+
+    for (unsigned long c = from; c <= to && c < CPU_SETSIZE; c++)
+      CPU_SET(c, set);
+
+    list = *end == ',' ? end + 1 : end;
+    if (*end != ',' && *end != '\0')
+      return false;
+  }
+
+  return true;
+}
+
+static void cpulist_format(const cpu_set_t *set, char *out, usize size) {
+  usize len = 0;
+  out[0] = '\0';
+
+  for (int c = 0; c < CPU_SETSIZE; c++) {
+    if (!CPU_ISSET(c, set))
+      continue;
+
+    int last = c;
+    while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, set))
+      last++;
+
+    int n = last == c ? snprintf(out + len, size - len, "%s%d",
+                                 len ? "," : "", c)
+                      : snprintf(out + len, size - len, "%s%d-%d",
+                                 len ? "," : "", c, last);
+    if (n < 0 || (usize)n >= size - len)
+      break;
+
+    len += n;
+    c = last;
+  }
+}
+
+// The test CPU and its SMT siblings, the helpers of the tests run there
+static void measurement_cpus(cpuid_t cpu, cpu_set_t *set) {
+  char buf[256];
+
+  CPU_ZERO(set);
+  CPU_SET(cpu, set);
+  if (quiet_read(tsprintf(QUIET_SYSFS_CPU
+                          "/cpu%d/topology/thread_siblings_list",
+                          cpu),
+                 buf, sizeof(buf)))
+    cpulist_parse(buf, set);
+}
+
+static struct quiet_saved *quiet_push(pid_t pid, const char *path,
+                                      const char *value) {
+  if (quiet_saved_count == QUIET_MAX_SAVED) {
+    plog(WARN, "Too many settings to save, %s is left as it is", path);
+    return NULL;
+  }
+
+  if (quiet_journal < 0) {
+    quiet_journal = open(quiet_journal_file(),
+                         O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+    if (quiet_journal < 0) {
+      plog(ERR, "Can't create %s: %s", quiet_journal_file(), strerror(errno));
+      return NULL;
+    }
+  }
+
+  struct quiet_saved *e = &quiet_saved[quiet_saved_count];
+  e->pid = pid;
+  snprintf(e->path, sizeof(e->path), "%s", path);
+  snprintf(e->value, sizeof(e->value), "%s", value);
+
+  // The journal is written before the change so it can't miss one
+  const char *line = tsprintf("%s\t%s\n", path, value);
+  if (write(quiet_journal, line, strlen(line)) != (ssize)strlen(line)) {
+    plog(ERR, "Can't write %s: %s", quiet_journal_path, strerror(errno));
+    return NULL;
+  }
+
+  quiet_saved_count++;
+  return e;
+}
+
+static bool quiet_set(const char *path, const char *value) {
+  char old[256];
+  if (!quiet_read(path, old, sizeof(old)))
+    return false;
+
+  if (!quiet_push(0, path, old))
+    return false;
+
+  if (!quiet_write(path, value)) {
+    // Restoring an untouched value from the journal is harmless
+    quiet_saved_count--;
+    return false;
+  }
+
+  return true;
+}
+
+// Journaled as pid:<pid>:<start time>:<comm>, a later start only replays it
+// on the same task
+static bool quiet_set_affinity(pid_t pid, const cpu_set_t *set) {
+  cpu_set_t old;
+  u64 start;
+  char comm[32];
+  if (sched_getaffinity(pid, sizeof(old), &old) != 0 ||
+      !quiet_task_start(pid, &start) ||
+      !quiet_read(tsprintf("/proc/%d/comm", pid), comm, sizeof(comm)))
+    return false;
+
+  char list[256];
+  cpulist_format(&old, list, sizeof(list));
+  if (!quiet_push(pid, tsprintf("pid:%d:%llu:%s", pid, start, comm), list))
+    return false;
+
+  // Per CPU kthreads refuse, they stay where they are
+  if (sched_setaffinity(pid, sizeof(*set), set) != 0) {
+    quiet_saved_count--;
+    return false;
+  }
+
+  return true;
+}
+
+// Safe to call more than once and from a signal handler
+void quiet_restore(void) {
+  if (restore_owner != getpid())
+    return;
+
+  while (quiet_saved_count > 0) {
+    struct quiet_saved *e = &quiet_saved[--quiet_saved_count];
+    if (e->pid) {
+      cpu_set_t set;
+      if (cpulist_parse(e->value, &set))
+        sched_setaffinity(e->pid, sizeof(set), &set);
+    } else {
+      quiet_write(e->path, e->value);
+    }
+  }
+
+  if (quiet_dma_latency >= 0) {
+    close(quiet_dma_latency);
+    quiet_dma_latency = -1;
+  }
+
+  if (quiet_journal >= 0) {
+    close(quiet_journal);
+    quiet_journal = -1;
+    unlink(quiet_journal_path);
+  }
+}
+
+// Whether the task journaled as `id`, <pid>:<start time>:<comm>, is still
+// the one running with that pid
+static bool quiet_same_task(const char *id, pid_t *pid) {
+  char *end;
+  *pid = strtol(id, &end, 10);
+  if (*end != ':')
+    return false;
 
-      // Don't care if it actually failed, make the full graph
-      execute_dependency(&cmd, t);
+  u64 saved_start = strtoull(end + 1, &end, 10);
+  if (*end != ':')
+    return false;
 
-      trestore(check);
+  u64 start;
+  char comm[32];
+  return quiet_task_start(*pid, &start) && start == saved_start &&
+         quiet_read(tsprintf("/proc/%d/comm", *pid), comm, sizeof(comm)) &&
+         strcmp(comm, end + 1) == 0;
+}
+
+// Replays the journal of a run that could not restore its settings
+void quiet_recover(void) {
+  const char *path = quiet_journal_file();
+  if (access(path, F_OK) != 0)
+    return;
+
+  str journal = {0};
+  if (!read_file(path, &journal)) {
+    plog(ERR, "Can't read %s, the machine settings may be wrong", path);
+    return;
+  }
+
+  plog(WARN, "Restoring the machine settings left by an earlier run");
+
+  restore_owner = getpid();
+  char *line = journal.items;
+  while (line && *line && quiet_saved_count < QUIET_MAX_SAVED) {
+    char *next = strchr(line, '\n');
+    if (next)
+      *next++ = '\0';
+
+    char *value = strchr(line, '\t');
+    if (value) {
+      *value++ = '\0';
+
+      pid_t pid = 0;
+      if (strncmp(line, "pid:", 4) == 0 && !quiet_same_task(line + 4, &pid)) {
+        plog(INFO, "%s exited since, its affinity is not restored", line);
+        line = next;
+        continue;
+      }
+
+      struct quiet_saved *e = &quiet_saved[quiet_saved_count++];
+      e->pid = pid;
+      snprintf(e->path, sizeof(e->path), "%s", line);
+      snprintf(e->value, sizeof(e->value), "%s", value);
     }
+
+    line = next;
   }
+  da_free(&journal);
 
-  cmd_free(&cmd);
+  quiet_restore();
+  unlink(path);
+}
+
+// Quiets the machine around `cpu` and its SMT siblings, returns the
+// quiet_setting_t bits that were applied
+u64 quiet_machine(cpuid_t cpu) {
+  u64 applied = 0;
+  char buf[256];
+
+  restore_on_exit();
+
+  cpu_set_t online, measured, housekeeping;
+  if (!quiet_read(QUIET_SYSFS_CPU "/online", buf, sizeof(buf)) ||
+      !cpulist_parse(buf, &online)) {
+    plog(ERR, "Can't read the online CPUs");
+    return 0;
+  }
+
+  measurement_cpus(cpu, &measured);
+  CPU_XOR(&housekeeping, &online, &measured);
+  CPU_AND(&housekeeping, &housekeeping, &online);
+
+  // Turbo first, cpuinfo_max_freq may not count it after
+  if (quiet_set(QUIET_SYSFS_CPU "/intel_pstate/no_turbo", "1") ||
+      quiet_set(QUIET_SYSFS_CPU "/cpufreq/boost", "0"))
+    applied |= 1ULL << QUIET_TURBO;
+
+  for (int c = 0; c < CPU_SETSIZE; c++) {
+    if (!CPU_ISSET(c, &online))
+      continue;
+
+    const char *freq = tsprintf(QUIET_SYSFS_CPU "/cpu%d/cpufreq/", c);
+    char max[32];
+    if (!quiet_read(tconcat(freq, "cpuinfo_max_freq", NULL), max, sizeof(max)))
+      continue;
+
+    // Max before min, the kernel refuses a min above the max
+    bool ok = quiet_set(tconcat(freq, "scaling_governor", NULL), "performance");
+    ok &= quiet_set(tconcat(freq, "scaling_max_freq", NULL), max);
+    ok &= quiet_set(tconcat(freq, "scaling_min_freq", NULL), max);
+    if (ok)
+      applied |= 1ULL << QUIET_GOVERNOR;
+  }
+
+  // The request holds as long as the file is open, the kernel drops it even
+  // when the orchestrator is killed
+  quiet_dma_latency = open("/dev/cpu_dma_latency", O_RDWR);
+  if (quiet_dma_latency >= 0) {
+    s32 latency = 0;
+    if (write(quiet_dma_latency, &latency, sizeof(latency)) ==
+        sizeof(latency)) {
+      applied |= 1ULL << QUIET_CSTATES;
+    } else {
+      close(quiet_dma_latency);
+      quiet_dma_latency = -1;
+    }
+  }
+
+  if (CPU_COUNT(&housekeeping) == 0) {
+    plog(WARN, "No CPU left for IRQs and RCU callbacks, they are not moved");
+  } else {
+    char list[256];
+    cpulist_format(&housekeeping, list, sizeof(list));
+
+    paths_t irqs = {0};
+    if (read_dir("/proc/irq", &irqs)) {
+      da_foreach(const char *, irq, &irqs) {
+        if (**irq < '0' || **irq > '9')
+          continue;
+
+        // Managed and per CPU IRQs refuse, they are left alone
+        if (quiet_set(tsprintf("/proc/irq/%s/smp_affinity_list", *irq), list))
+          applied |= 1ULL << QUIET_IRQS;
+      }
+    }
+    da_free(&irqs);
+
+    // The callback offload and grace period kthreads, the per CPU ones can't
+    // move
+    paths_t procs = {0};
+    if (read_dir("/proc", &procs)) {
+      da_foreach(const char *, pid, &procs) {
+        char comm[32];
+        if (**pid < '0' || **pid > '9' ||
+            !quiet_read(tsprintf("/proc/%s/comm", *pid), comm, sizeof(comm)) ||
+            strncmp(comm, "rcu", 3) != 0)
+          continue;
+
+        if (quiet_set_affinity(atoi(*pid), &housekeeping))
+          applied |= 1ULL << QUIET_RCU;
+      }
+    }
+    da_free(&procs);
+  }
+
+  for (int i = 0; i < QUIET_NUM; i++) {
+    plog(applied & (1ULL << i) ? INFO : WARN, "%s %s", quiet_setting_t_strs[i],
+         applied & (1ULL << i) ? "applied" : "not applied");
+  }
+
+  return applied;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// --isolate
+//
+// The measurement CPUs become an isolated cgroup v2 cpuset partition: the
+// scheduler stops balancing onto them and only the tasks of the cgroup can
+// run there. The orchestrator joins it just for the test and goes back to
+// its own cgroup, so compilers and the rest stay on the other CPUs.
+///////////////////////////////////////////////////////////////////////////////
+
+#define ISOLATE_CGROUP_ROOT "/sys/fs/cgroup"
+#define ISOLATE_CGROUP ISOLATE_CGROUP_ROOT "/tea-checker"
+
+static bool isolate_active = false;
+static bool isolate_inside = false;
+static char isolate_home[256];
+static char isolate_pid[32];
+
+bool isolate_setup(cpuid_t cpu, const char *cpus) {
+  char buf[256];
+
+  if (!quiet_read(ISOLATE_CGROUP_ROOT "/cgroup.controllers", buf,
+                  sizeof(buf)) ||
+      !strstr(buf, "cpuset")) {
+    plog(ERR, "No cgroup v2 cpuset controller in " ISOLATE_CGROUP_ROOT);
+    return false;
+  }
+
+  // Where the orchestrator lives, "0::/path" in /proc/self/cgroup
+  if (!quiet_read("/proc/self/cgroup", buf, sizeof(buf)) ||
+      strncmp(buf, "0::", 3) != 0) {
+    plog(ERR, "The orchestrator is not in a cgroup v2 hierarchy");
+    return false;
+  }
+  snprintf(isolate_home, sizeof(isolate_home),
+           ISOLATE_CGROUP_ROOT "%s/cgroup.procs",
+           strcmp(buf + 3, "/") == 0 ? "" : buf + 3);
+  snprintf(isolate_pid, sizeof(isolate_pid), "%d", getpid());
+
+  cpu_set_t set;
+  if (cpus) {
+    if (!cpulist_parse(cpus, &set)) {
+      plog(ERR, "Invalid CPU list for --isolate: %s", cpus);
+      return false;
+    }
+  } else {
+    measurement_cpus(cpu, &set);
+  }
+
+  char list[256];
+  cpulist_format(&set, list, sizeof(list));
+
+  // Left behind by a run that was killed, it is empty by now
+  rmdir(ISOLATE_CGROUP);
+
+  // Enabling the controller on the root is harmless, it is left enabled
+  quiet_write(ISOLATE_CGROUP_ROOT "/cgroup.subtree_control", "+cpuset");
+  if (mkdir(ISOLATE_CGROUP, 0755) != 0) {
+    plog(ERR, "Can't create " ISOLATE_CGROUP ": %s", strerror(errno));
+    return false;
+  }
+
+  restore_on_exit();
+  isolate_active = true;
+
+  if (!quiet_write(ISOLATE_CGROUP "/cpuset.cpus", list) ||
+      !quiet_write(ISOLATE_CGROUP "/cpuset.cpus.partition", "isolated") ||
+      !quiet_read(ISOLATE_CGROUP "/cpuset.cpus.partition", buf, sizeof(buf)) ||
+      strcmp(buf, "isolated") != 0) {
+    // The reason is in the file, e.g. "isolated invalid (...)"
+    plog(ERR, "Can't isolate CPUs %s: %s", list, buf);
+    isolate_teardown();
+    return false;
+  }
+
+  plog(INFO, "CPUs %s isolated in " ISOLATE_CGROUP, list);
   return true;
+}
 
-fail:
+// Moves the orchestrator, and what it starts from now on, to the partition
+bool isolate_enter(void) {
+  if (!isolate_active || isolate_inside)
+    return true;
 
-  trestore(check);
-  cmd_free(&cmd);
-  return false;
+  if (!quiet_write(ISOLATE_CGROUP "/cgroup.procs", isolate_pid)) {
+    plog(ERR, "Can't join " ISOLATE_CGROUP ": %s", strerror(errno));
+    return false;
+  }
+
+  isolate_inside = true;
+  return true;
+}
+
+void isolate_leave(void) {
+  if (!isolate_inside)
+    return;
+
+  if (!quiet_write(isolate_home, isolate_pid))
+    plog(ERR, "Can't go back to %s: %s", isolate_home, strerror(errno));
+
+  isolate_inside = false;
+}
+
+// No stdio, it also runs from the signal handlers
+void isolate_teardown(void) {
+  if (restore_owner != getpid() || !isolate_active)
+    return;
+
+  if (isolate_inside) {
+    quiet_write(isolate_home, isolate_pid);
+    isolate_inside = false;
+  }
+
+  // Removing the cgroup gives the CPUs back to the root partition
+  rmdir(ISOLATE_CGROUP);
+  isolate_active = false;
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Telemetry
+//
+// The counters are read right before and after the test, outside of the
+// measured code. A sampler pinned away from the test CPU follows its
+// frequency and the temperatures in between. It is a process of its own,
+// forked before the test: a thread would follow the orchestrator into the
+// --isolate partition and onto the measurement CPUs.
+///////////////////////////////////////////////////////////////////////////////
+
+#define TELEMETRY_PERIOD_NS (10 * 1000 * 1000)
+#define TELEMETRY_MAX_ZONES 32
+
+struct telemetry_snapshot {
+  u64 ns;
+  u64 interrupts;
+  u64 softirqs;
+  u64 voluntary_switches;
+  u64 involuntary_switches;
+  u64 throttles;
+};
+
+static struct {
+  cpuid_t cpu;
+  struct telemetry_snapshot start;
+  pid_t sampler;
+  int stop_fd;   // Closed to stop the sampler
+  int result_fd; // Where it writes what it sampled
+} telemetry_state = {.sampler = -1, .stop_fd = -1, .result_fd = -1};
+
+// Column `cpu` of /proc/interrupts or /proc/softirqs, summed over the rows
+static u64 telemetry_proc_column(const char *path, cpuid_t cpu) {
+  FILE *f = fopen(path, "r");
+  if (!f)
+    return 0;
+
+  char line[4096];
+  u64 sum = 0;
+  s32 column = -1;
+
+  // Only the online CPUs have a column
+  if (fgets(line, sizeof(line), f)) {
+    s32 i = 0;
+    for (char *tok = strtok(line, " \t\n"); tok; tok = strtok(NULL, " \t\n")) {
+      if (strncmp(tok, "CPU", 3) == 0 && atoi(tok + 3) == cpu)
+        column = i;
+      i++;
+    }
+  }
+
+  while (column >= 0 && fgets(line, sizeof(line), f)) {
+    char *p = strchr(line, ':');
+    if (!p)
+      continue;
+    p++;
+
+    for (s32 i = 0; i <= column; i++) {
+      char *end;
+      u64 v = strtoull(p, &end, 10);
+      if (end == p)
+        break; // ERR, MIS and the like have a single column
+
+      if (i == column)
+        sum += v;
+      p = end;
+    }
+  }
+
+  fclose(f);
+  return sum;
+}
+
+static u64 telemetry_sysfs_u64(const char *path) {
+  char buf[64];
+  return quiet_read(path, buf, sizeof(buf)) ? strtoull(buf, NULL, 10) : 0;
+}
+
+static void telemetry_snapshot(cpuid_t cpu, struct telemetry_snapshot *s) {
+  s->ns = monotonic_ns();
+  s->interrupts = telemetry_proc_column("/proc/interrupts", cpu);
+  s->softirqs = telemetry_proc_column("/proc/softirqs", cpu);
+
+  // The thread calling the test for the library and kernel tests, the exe
+  // testers are children
+  struct rusage self, children;
+  getrusage(RUSAGE_THREAD, &self);
+  getrusage(RUSAGE_CHILDREN, &children);
+  s->voluntary_switches = self.ru_nvcsw + children.ru_nvcsw;
+  s->involuntary_switches = self.ru_nivcsw + children.ru_nivcsw;
+
+  s->throttles =
+      telemetry_sysfs_u64(tsprintf(QUIET_SYSFS_CPU
+                                   "/cpu%d/thermal_throttle/core_throttle_count",
+                                   cpu)) +
+      telemetry_sysfs_u64(tsprintf(
+          QUIET_SYSFS_CPU "/cpu%d/thermal_throttle/package_throttle_count",
+          cpu));
+}
+
+// Runs in the forked sampler until `stop` is closed
+static void telemetry_sampler(cpuid_t cpu, int stop, int result) {
+  telemetry_t sampled = {0};
+  telemetry_t *t = &sampled;
+  char freq_path[128];
+  snprintf(freq_path, sizeof(freq_path),
+           QUIET_SYSFS_CPU "/cpu%d/cpufreq/scaling_cur_freq", cpu);
+
+  struct pollfd stopped = {.fd = stop, .events = POLLIN};
+  do {
+    u64 freq = telemetry_sysfs_u64(freq_path);
+    if (freq && (!t->min_freq_khz || freq < t->min_freq_khz))
+      t->min_freq_khz = freq;
+    if (freq > t->max_freq_khz)
+      t->max_freq_khz = freq;
+
+    for (int z = 0; z < TELEMETRY_MAX_ZONES; z++) {
+      char path[64];
+      snprintf(path, sizeof(path), "/sys/class/thermal/thermal_zone%d/temp", z);
+      if (access(path, R_OK) != 0)
+        break;
+
+      u64 temp = telemetry_sysfs_u64(path);
+      if (temp > t->max_temp_mc)
+        t->max_temp_mc = temp;
+    }
+
+    t->samples++;
+  } while (poll(&stopped, 1, TELEMETRY_PERIOD_NS / 1000000) == 0);
+
+  if (write(result, &sampled, sizeof(sampled)) != sizeof(sampled))
+    _exit(1);
+  _exit(0);
+}
+
+void telemetry_begin(cpuid_t cpu) {
+  telemetry_state.cpu = cpu;
+
+  // Anywhere but the test CPU and its siblings
+  cpu_set_t online, measured, housekeeping;
+  char buf[256];
+  CPU_ZERO(&housekeeping);
+  if (quiet_read(QUIET_SYSFS_CPU "/online", buf, sizeof(buf)) &&
+      cpulist_parse(buf, &online)) {
+    measurement_cpus(cpu, &measured);
+    CPU_XOR(&housekeeping, &online, &measured);
+    CPU_AND(&housekeeping, &housekeeping, &online);
+  }
+
+  int stop[2], result[2];
+  if (pipe(stop) != 0) {
+    plog(WARN, "No telemetry sampler: %s", strerror(errno));
+    goto snapshot;
+  }
+  if (pipe(result) != 0) {
+    plog(WARN, "No telemetry sampler: %s", strerror(errno));
+    close(stop[0]);
+    close(stop[1]);
+    goto snapshot;
+  }
+
+  fflush(stdout);
+  fflush(stderr);
+  pid_t pid = fork();
+  if (pid == 0) {
+    close(stop[1]);
+    close(result[0]);
+    if (CPU_COUNT(&housekeeping) > 0)
+      sched_setaffinity(0, sizeof(housekeeping), &housekeeping);
+    telemetry_sampler(cpu, stop[0], result[1]);
+  }
+
+  close(stop[0]);
+  close(result[1]);
+  if (pid < 0) {
+    plog(WARN, "No telemetry sampler: %s", strerror(errno));
+    close(stop[1]);
+    close(result[0]);
+    goto snapshot;
+  }
+
+  telemetry_state.sampler = pid;
+  telemetry_state.stop_fd = stop[1];
+  telemetry_state.result_fd = result[0];
+
+snapshot:
+  telemetry_snapshot(cpu, &telemetry_state.start);
+}
+
+void telemetry_end(telemetry_t *out, const char *module_name) {
+  struct telemetry_snapshot end;
+  telemetry_snapshot(telemetry_state.cpu, &end);
+
+  // Reaped after the snapshot, its switches are not counted as the tester's
+  telemetry_t sampled = {0};
+  if (telemetry_state.sampler > 0) {
+    close(telemetry_state.stop_fd);
+    if (read(telemetry_state.result_fd, &sampled, sizeof(sampled)) !=
+        sizeof(sampled)) {
+      plog(WARN, "The telemetry sampler of %s died", module_name);
+      sampled = (telemetry_t){0};
+    }
+    close(telemetry_state.result_fd);
+    waitpid(telemetry_state.sampler, NULL, 0);
+
+    telemetry_state.sampler = -1;
+    telemetry_state.stop_fd = telemetry_state.result_fd = -1;
+  }
+
+  const struct telemetry_snapshot *start = &telemetry_state.start;
+  *out = sampled;
+  out->duration_ns = end.ns - start->ns;
+  out->interrupts = end.interrupts - start->interrupts;
+  out->softirqs = end.softirqs - start->softirqs;
+  out->voluntary_switches = end.voluntary_switches - start->voluntary_switches;
+  out->involuntary_switches =
+      end.involuntary_switches - start->involuntary_switches;
+  out->throttles = end.throttles - start->throttles;
+
+  plog(INFO,
+       "%s telemetry: %llu irqs, %llu softirqs, %llu/%llu switches, "
+       "%llu-%llu kHz, %llu mC, %llu throttles",
+       module_name, out->interrupts, out->softirqs, out->voluntary_switches,
+       out->involuntary_switches, out->min_freq_khz, out->max_freq_khz,
+       out->max_temp_mc, out->throttles);
+
+  if (out->involuntary_switches || out->throttles)
+    plog(WARN, "%s was measured on a noisy machine", module_name);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Phase timing
+//
+// Wall time of the harness around every test. PHASE_DEPENDENCIES of a test
+// holds all the phases of the dependencies it started, so it is left out of
+// its own total.
+///////////////////////////////////////////////////////////////////////////////
+
+#define PHASE_NAME(p) (phase_t_strs[p] + strlen("PHASE_"))
+
+static u64 phase_children_ns(void) {
+  struct rusage r;
+  getrusage(RUSAGE_CHILDREN, &r);
+  return (r.ru_utime.tv_sec + r.ru_stime.tv_sec) * 1000000000ULL +
+         (r.ru_utime.tv_usec + r.ru_stime.tv_usec) * 1000ULL;
+}
+
+phase_clock_t phase_begin(void) {
+  return (phase_clock_t){
+      .wall_ns = monotonic_ns(),
+      .child_ns = phase_children_ns(),
+  };
+}
+
+static void trace_span(const char *name, phase_t phase, cpuid_t cpu,
+                       u64 start_ns, u64 end_ns);
+
+void phase_end(test_t *t, phase_t phase, phase_clock_t clock) {
+  const u64 now = monotonic_ns();
+  t->phases.wall_ns[phase] += now - clock.wall_ns;
+  t->phases.child_ns[phase] += phase_children_ns() - clock.child_ns;
+  trace_span(t->module_name, phase, t->opts.cpu, clock.wall_ns, now);
+}
+
+// For a phase shared by several tests, such as a simulation bundle, split
+// evenly between the `shared` ones
+void phase_end_shared(usize n, test_t tests[static n], bool shared[static n],
+                      phase_t phase, phase_clock_t clock) {
+  const u64 now = monotonic_ns();
+  const u64 wall = now - clock.wall_ns;
+  const u64 child = phase_children_ns() - clock.child_ns;
+
+  usize count = 0;
+  for (usize i = 0; i < n; i++)
+    count += shared[i];
+  if (count == 0)
+    return;
+
+  trace_span(tsprintf("bundle of %zu", count), phase, tests[0].opts.cpu,
+             clock.wall_ns, now);
+
+  for (usize i = 0; i < n; i++) {
+    if (!shared[i])
+      continue;
+    tests[i].phases.wall_ns[phase] += wall / count;
+    tests[i].phases.child_ns[phase] += child / count;
+  }
+}
+
+// Milliseconds per phase of every test that ran, with the CPU time of the
+// child processes in the last column
+void phase_summary(void) {
+  u64 wall[PHASE_NUM] = {0};
+  u64 own = 0, child = 0;
+
+  // Only the root entry, nothing ran
+  if (runned_test.count <= 1)
+    return;
+
+  printf("\n%-24s", "module");
+  for (s32 p = 0; p < PHASE_NUM; p++)
+    printf(" %*s", (int)strlen(PHASE_NAME(p)), PHASE_NAME(p));
+  printf(" %9s %9s\n", "total", "children");
+
+  da_foreach(test_t, t, &runned_test) {
+    if (strcmp(t->module_name, "root") == 0)
+      continue;
+
+    u64 test_own = 0, test_child = 0;
+    printf("%-24s", t->module_name);
+    for (s32 p = 0; p < PHASE_NUM; p++) {
+      printf(" %*.1f", (int)strlen(PHASE_NAME(p)),
+             t->phases.wall_ns[p] / 1e6);
+      if (p == PHASE_DEPENDENCIES)
+        continue;
+
+      wall[p] += t->phases.wall_ns[p];
+      test_own += t->phases.wall_ns[p];
+      test_child += t->phases.child_ns[p];
+    }
+    printf(" %9.1f %9.1f\n", test_own / 1e6, test_child / 1e6);
+
+    own += test_own;
+    child += test_child;
+  }
+
+  printf("%-24s", "total");
+  for (s32 p = 0; p < PHASE_NUM; p++) {
+    if (p == PHASE_DEPENDENCIES)
+      printf(" %*s", (int)strlen(PHASE_NAME(p)), "-");
+    else
+      printf(" %*.1f", (int)strlen(PHASE_NAME(p)), wall[p] / 1e6);
+  }
+  printf(" %9.1f %9.1f\n", own / 1e6, child / 1e6);
+}
+
+///////////////////////////////////////////////////////////////////////////////
+// Trace export
+//
+// A trace-event JSON array for Perfetto or chrome://tracing. Every event is a
+// single write() to a file opened with O_APPEND, so the forked simulation
+// slots can share it and nothing is buffered across a fork. The viewers
+// accept the trailing comma the slots leave before the closing bracket of
+// the parent.
+//
+// Every process is a worker, its threads are the tracks: one for the
+// harness, one for the compile jobs and one per test CPU for the runs.
+///////////////////////////////////////////////////////////////////////////////
+
+#define TRACE_TID_WORKER 0
+#define TRACE_TID_COMPILE 1
+#define TRACE_TID_CPU 16
+#define TRACE_MAX_TRACKS (TRACE_TID_CPU + 256)
+
+static struct {
+  fd fd;
+  u64 start_ns;
+  bool named[TRACE_MAX_TRACKS];
+} trace_state = {.fd = -1};
+
+static void trace_write(const char *fmt, ...) {
+  char buf[512];
+  va_list ap;
+  va_start(ap, fmt);
+  s32 n = vsnprintf(buf, sizeof(buf), fmt, ap);
+  va_end(ap);
+
+  if (n > 0 && n < (s32)sizeof(buf))
+    write(trace_state.fd, buf, n);
+}
+
+static double trace_us(u64 ns) { return (ns - trace_state.start_ns) / 1e3; }
+
+static s32 trace_track(phase_t phase, cpuid_t cpu) {
+  s32 tid = TRACE_TID_WORKER;
+  if (phase == PHASE_BUILD || phase == PHASE_MANAGER_BUILD)
+    tid = TRACE_TID_COMPILE;
+  else if (phase == PHASE_RUN && cpu >= 0 &&
+           cpu < TRACE_MAX_TRACKS - TRACE_TID_CPU)
+    tid = TRACE_TID_CPU + cpu;
+
+  if (!trace_state.named[tid]) {
+    trace_state.named[tid] = true;
+    const char *name = tid == TRACE_TID_WORKER    ? "harness"
+                       : tid == TRACE_TID_COMPILE ? "compile"
+                                                  : tsprintf("cpu %d", cpu);
+    trace_write("{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,"
+                "\"args\":{\"name\":\"%s\"}},\n",
+                getpid(), tid, name);
+    trace_write("{\"name\":\"thread_sort_index\",\"ph\":\"M\",\"pid\":%d,"
+                "\"tid\":%d,\"args\":{\"sort_index\":%d}},\n",
+                getpid(), tid, tid);
+  }
+
+  return tid;
+}
+
+bool trace_open(const char *path) {
+  trace_state.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0644);
+  if (trace_state.fd < 0) {
+    plog(ERR, "Could not open the trace %s: %s", path, strerror(errno));
+    return false;
+  }
+
+  trace_state.start_ns = monotonic_ns();
+  trace_write("[\n");
+  trace_process("orchestrator");
+  return true;
+}
+
+// Names the current process, called again by every forked worker
+void trace_process(const char *name) {
+  if (trace_state.fd < 0)
+    return;
+
+  memset(trace_state.named, 0, sizeof(trace_state.named));
+  trace_write("{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":0,"
+              "\"args\":{\"name\":\"%s\"}},\n",
+              getpid(), name);
+}
+
+static void trace_span(const char *name, phase_t phase, cpuid_t cpu,
+                       u64 start_ns, u64 end_ns) {
+  if (trace_state.fd < 0)
+    return;
+
+  const s32 tid = trace_track(phase, cpu);
+  trace_write("{\"name\":\"%s %s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,"
+              "\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f},\n",
+              name, PHASE_NAME(phase), PHASE_NAME(phase), getpid(), tid,
+              trace_us(start_ns), (end_ns - start_ns) / 1e3);
+}
+
+void trace_instant(test_t *t, const char *what) {
+  if (trace_state.fd < 0)
+    return;
+
+  const s32 tid = trace_track(PHASE_NUM, t->opts.cpu);
+  trace_write("{\"name\":\"%s %s\",\"cat\":\"result\",\"ph\":\"i\","
+              "\"s\":\"t\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f},\n",
+              t->module_name, what, getpid(), tid, trace_us(monotonic_ns()));
+}
+
+// Marks the runs that have to be repeated or that failed
+void trace_result(test_t *t) {
+  if (t->result_code == RETRY)
+    trace_instant(t, "RETRY");
+  else if (t->result_code != OK)
+    trace_instant(t, "KO");
+}
+
+void trace_close(void) {
+  if (trace_state.fd < 0)
+    return;
+
+  // Without a trailing comma, so the array is well formed
+  trace_write("{\"name\":\"end\",\"ph\":\"i\",\"s\":\"g\",\"pid\":%d,"
+              "\"tid\":0,\"ts\":%.3f}\n]\n",
+              getpid(), trace_us(monotonic_ns()));
+  close(trace_state.fd);
+  trace_state.fd = -1;
+}
+
+// Undoes --isolate and --quiet-machine, safe from a signal handler
+void restore_machine(void) {
+  isolate_teardown();
+  quiet_restore();
+}
+
+static void restore_signal_handler(int sig) {
+  if (sim_group > 0)
+    kill(-sim_group, SIGTERM);
+  restore_machine();
+  signal(sig, SIG_DFL);
+  raise(sig);
+}
+
+void restore_on_exit(void) {
+  static bool installed = false;
+  if (installed)
+    return;
+
+  installed = true;
+  restore_owner = getpid();
+  atexit(restore_machine);
+
+  const int signals[] = {SIGINT, SIGTERM, SIGHUP, SIGQUIT,
+                         SIGSEGV, SIGBUS, SIGABRT, SIGFPE};
+  for (usize i = 0; i < sizeof(signals) / sizeof(*signals); i++)
+    signal(signals[i], restore_signal_handler);
 }
 
 static void segfault_handler(int sig, siginfo_t *info, void *ucontext) {
   plog(ERR, "Detected memory fault");
 
+  restore_machine();
+
   cmd_t cmd = {};
 
   cmd_append(&cmd, "rmmod", "probe");
@@ -1236,12 +3508,24 @@ void print_help(const char *program_name, int exit_code) {
          "\t--new/-n\t\tCreates a new module with name <arg>\n"
          "\t--target/-t\t\tGive the architeture to compile to (" str_fmt ")\n"
          "\t--runner/-r\t\tRunner for the test (" str_fmt ")\n"
-         "\t--clock-speed/-c\t\tClock speed of the CPU\n"
+         "\t--clock-speed/-c\t\tCore clock in Hz, replaces the calibration\n"
          "\t--kernel-headers/-k\t\tKernel headers directory\n"
          "\t--mitigate/-m\t\tRemove feature detection\n"
          "\t--save/-s\t\tSave run\n"
+         "\t--quiet-machine/-q\t\tPin the frequency, disable turbo and deep "
+         "C-states, move IRQs and RCU callbacks away from the test CPU for the "
+         "run\n"
+         "\t--isolate/-i\t\tRun the tests in an isolated cpuset partition of "
+         "the given CPU list (default: the test CPU and its SMT siblings)\n"
+         "\t--quality-attempts/-a\t\tMeasurements of a test that fails its "
+         "quality metric before its result is kept anyway (default: %d)\n"
+         "\t--trace/-T\t\tWrite a timeline of the run to <arg>, in the "
+         "trace event format of Perfetto and chrome://tracing\n"
+         "\t--seed/-S\t\tSeed of the random numbers of the tests (default: "
+         "a new one every run, printed and saved with the run)\n"
          "\t--help/-h\t\tPrint this help\n",
-         program_name, str_arg(&targets), str_arg(&runners));
+         program_name, str_arg(&targets), str_arg(&runners),
+         QUALITY_DEFAULT_ATTEMPTS);
   exit(exit_code);
 }
 
@@ -1257,6 +3541,16 @@ void print_help_sims(const char *program_name, int exit_code) {
   printf("help %s --runner RUNNER_SIMULATION:\n"
          "\t--platform/-p\t\tType of simulation platform (" str_fmt ")\n"
          "\t--shell/-s\t\tShell to be used when using runner SIMULATION\n"
+         "\t--bundle/-b\t\tMax number of modules linked in one simulation "
+         "(default 1)\n"
+         "\t--slots/-j\t\tNumber of simulations run at the same time "
+         "(default 1)\n"
+         "\t--heap-size/-m\t\tBytes of the static heap of the simulated "
+         "tester\n"
+         "\t--harts/-n\t\tNumber of harts of the simulated config "
+         "(default " TOSTRING(SIM_DEFAULT_HARTS) ")\n"
+         "\t--checkpoint/-k\t\tRestore every run from a checkpoint taken "
+         "after boot, not with --bundle\n"
          "\t--help/-h\t\tPrint this help\n\n",
          program_name, str_arg(&sims));
 
@@ -1334,9 +3628,14 @@ int parse_sim_options(const char *program_name, int argc, char *argv[],
 
   int opt;
   while ((opt = getopt_long(
-              argc, argv, "+p:s:h",
+              argc, argv, "+p:s:b:j:m:n:kh",
               (struct option[]){{"platform", required_argument, 0, 'p'},
                                 {"shell", required_argument, 0, 'c'},
+                                {"bundle", required_argument, 0, 'b'},
+                                {"slots", required_argument, 0, 'j'},
+                                {"heap-size", required_argument, 0, 'm'},
+                                {"harts", required_argument, 0, 'n'},
+                                {"checkpoint", no_argument, 0, 'k'},
                                 {"help", no_argument, 0, 'h'},
                                 {0, 0, 0, 0}},
               NULL)) != -1) {
@@ -1362,6 +3661,50 @@ int parse_sim_options(const char *program_name, int argc, char *argv[],
       opts->extra_sim_options.shell = strdup(optarg);
       break;
 
+    case 'b': {
+      char *end;
+      long n = strtol(optarg, &end, 10);
+      if (*end != '\0' || n <= 0) {
+        plog(INFO, "Invalid bundle size: %s", optarg);
+        print_help_sims(program_name, 1);
+      }
+      opts->extra_sim_options.bundle = n;
+    } break;
+
+    case 'j': {
+      char *end;
+      long n = strtol(optarg, &end, 10);
+      if (*end != '\0' || n <= 0) {
+        plog(INFO, "Invalid number of slots: %s", optarg);
+        print_help_sims(program_name, 1);
+      }
+      opts->extra_sim_options.slots = n;
+    } break;
+
+    case 'm': {
+      char *end;
+      unsigned long long n = strtoull(optarg, &end, 0);
+      if (*end != '\0' || n == 0) {
+        plog(INFO, "Invalid heap size: %s", optarg);
+        print_help_sims(program_name, 1);
+      }
+      opts->extra_sim_options.heap_size = n;
+    } break;
+
+    case 'n': {
+      char *end;
+      long n = strtol(optarg, &end, 10);
+      if (*end != '\0' || n <= 0) {
+        plog(INFO, "Invalid number of harts: %s", optarg);
+        print_help_sims(program_name, 1);
+      }
+      opts->extra_sim_options.harts = n;
+    } break;
+
+    case 'k':
+      opts->extra_sim_options.checkpoint = true;
+      break;
+
     case 'h':
       print_help_sims(program_name, 0);
       break;
@@ -1379,6 +3722,21 @@ int parse_sim_options(const char *program_name, int argc, char *argv[],
   }
 
 exit:
+  if (opts->extra_sim_options.bundle == 0)
+    opts->extra_sim_options.bundle = 1;
+  if (opts->extra_sim_options.slots == 0)
+    opts->extra_sim_options.slots = 1;
+  if (opts->extra_sim_options.harts == 0)
+    opts->extra_sim_options.harts = SIM_DEFAULT_HARTS;
+
+  // A bundle boots once for all of its modules, there is no single point
+  // to take the checkpoint at
+  if (opts->extra_sim_options.checkpoint &&
+      opts->extra_sim_options.bundle > 1) {
+    plog(INFO, "--checkpoint can't be used with --bundle");
+    print_help_sims(program_name, 1);
+  }
+
   if (opts->extra_sim_options.shell == NULL) {
     plog(INFO, "Missing shell");
     print_help_sims(program_name, 1);
@@ -1398,7 +3756,7 @@ void parse_options(int argc, char *argv[], run_options_t *opts) {
 
   int opt;
   while ((opt = getopt_long(
-              argc, argv, "+n:t:r:c:hm:s::k:",
+              argc, argv, "+n:t:r:c:hm:s::k:qi::a:T:S:",
               (struct option[]){{"new", required_argument, 0, 'n'},
                                 {"target", required_argument, 0, 't'},
                                 {"runner", required_argument, 0, 'r'},
@@ -1406,6 +3764,12 @@ void parse_options(int argc, char *argv[], run_options_t *opts) {
                                 {"kernel-headers", required_argument, 0, 'k'},
                                 {"mitigate", required_argument, 0, 'm'},
                                 {"save", optional_argument, 0, 's'},
+                                {"quiet-machine", no_argument, 0, 'q'},
+                                {"isolate", optional_argument, 0, 'i'},
+                                {"quality-attempts", required_argument, 0,
+                                 'a'},
+                                {"trace", required_argument, 0, 'T'},
+                                {"seed", required_argument, 0, 'S'},
                                 {"help", no_argument, 0, 'h'},
                                 {0, 0, 0, 0}},
               NULL)) != -1) {
@@ -1460,6 +3824,28 @@ void parse_options(int argc, char *argv[], run_options_t *opts) {
       opts->clock_speed = strtoul(optarg, NULL, 10);
       break;
 
+    case 'q':
+      opts->quiet_machine = true;
+      break;
+
+    case 'i':
+      opts->isolate = true;
+      if (optarg)
+        opts->isolate_cpus = strdup(optarg);
+      break;
+
+    case 'a':
+      opts->quality_attempts = strtoul(optarg, NULL, 10);
+      break;
+
+    case 'T':
+      opts->trace_file = strdup(optarg);
+      break;
+
+    case 'S':
+      opts->seed = strtoul(optarg, NULL, 10);
+      break;
+
     case 'k':
       kernel_header_dir = strdup(optarg);
       break;
@@ -1485,9 +3871,8 @@ void parse_options(int argc, char *argv[], run_options_t *opts) {
     print_help(program_name, 1);
   }
 
-  if (opts->clock_speed == 0) {
-    opts->clock_speed = 100000000;
-  }
+  if (opts->quality_attempts == 0)
+    opts->quality_attempts = QUALITY_DEFAULT_ATTEMPTS;
 
   /* plog(INFO, "---- %s", argv[optind - 1]); */
   /* plog(INFO, "---- %d", optind); */
@@ -1592,14 +3977,38 @@ int main(int argc, char *argv[]) {
   plog(INFO, "kernel headers used: %s", kernel_header_dir);
   plog(INFO, "%d", __tmpbuf_curr_size);
 
-  u64 *clock_speed = malloc(sizeof(u64));
-  *clock_speed = opts.clock_speed;
+  if (opts.trace_file && !trace_open(opts.trace_file))
+    plog(WARN, "Running without a trace");
+
+  root_result_t *root = calloc(1, sizeof(*root));
+
+  quiet_recover();
+  if (opts.quiet_machine)
+    root->quiet_settings = quiet_machine(opts.cpu);
+
+  // Nothing of a simulation runs on the measured CPUs
+  if (opts.isolate && opts.runner != RUNNER_SIMULATION &&
+      !isolate_setup(opts.cpu, opts.isolate_cpus))
+    plog(WARN, "Running without CPU isolation");
+
+  // After the quieting, the frequency it pins is the one to measure. The
+  // test CPU is only in the cpuset of the partition once it is isolated.
+  isolate_enter();
+  calibrate(&opts);
+  isolate_leave();
+  // Recorded in the root result, --seed replays it
+  calibration.seed = opts.seed;
+  while (calibration.seed == 0)
+    calibration.seed = monotonic_ns() ^ ((u64)getpid() << 16);
+  plog(INFO, "run seed: %u", calibration.seed);
+  root->calibration = calibration;
+
   test_t t = {
       .opts = opts,
       .module_name = "root",
       .result_code = OK,
-      .result_size = sizeof(u64),
-      .result = clock_speed,
+      .result_size = sizeof(*root),
+      .result = root,
   };
   da_append(&runned_test, t);
 
@@ -1678,6 +4087,8 @@ int main(int argc, char *argv[]) {
   if (!execute_dependencies(&t)) {
     plog(ERR, "Execution failed");
   }
+  phase_summary();
+  trace_close();
 
   char timestamp[40] = {0};
   get_timestamp_utc(timestamp, 40);
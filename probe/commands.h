@@ -10,6 +10,11 @@ enum probe_command {
   PROBE_TLB_FLUSH_PAGE = 5,
   PROBE_TLB_REMOVE_PTE = 6,
   PROBE_TLB_RESTORE_PTE = 7,
+  PROBE_RING_SUBMIT = 8,
+  PROBE_MEASURE = 9,
+  PROBE_PTE_CLEAR_BATCH = 10,
+  PROBE_PTE_RESTORE_BATCH = 11,
+  PROBE_SET_TARGET = 12,
 };
 
 struct probe_request {
@@ -17,4 +22,128 @@ struct probe_request {
   usize *access_time;
 };
 
+// Every open file of the probe device has its own target buffer of
+// PROBE_TARGET_SZ bytes, allocated on the node of the CPU that opened it. The
+// probe target is the cache line at `offset` in that buffer, so tests can pick
+// the cache set and page they collide with. PROBE_SET_TARGET moves it and
+// returns the kernel address of the new target in `addr`, `cpu` < 0 keeps the
+// buffer where it is.
+#define PROBE_TARGET_PAGES 16
+#define PROBE_TARGET_SZ (PROBE_TARGET_PAGES * 4096)
+
+struct probe_target {
+  s32 cpu;
+  u32 offset;
+  usize addr;
+};
+
+// Every open file of the probe device keeps up to PROBE_PTE_SLOTS saved PTEs
+// keyed by page address, together with the walked pte_t * so clearing the same
+// page again does not walk the page tables again. The batch ioctls clear or
+// restore `count` pages with a single fence at the end, `status` is optional
+// and receives the result of every page.
+#define PROBE_PTE_SLOTS 256
+
+struct probe_pte_batch {
+  usize count;
+  usize *addrs;
+  s32 *status;
+};
+
+// Batched probe operations. User space fills the mmap'd ring of the probe
+// device and submits the first `count` entries with a single
+// PROBE_RING_SUBMIT, the driver runs them in order with preemption disabled
+// and writes back `status` and `result` of every op.
+enum probe_op_kind {
+  PROBE_OP_NOP = 0,
+  PROBE_OP_FLUSH = 1,          // clflush the probe target
+  PROBE_OP_CACHE = 2,          // load the probe target
+  PROBE_OP_TIME_LOAD = 3,      // timed load of the probe target -> result
+  PROBE_OP_TLB_FLUSH = 4,      // flush the whole TLB
+  PROBE_OP_TLB_FLUSH_PAGE = 5, // flush `addr` from the TLB
+  PROBE_OP_PTE_CLEAR = 6,      // clear the present bit of `addr`, no flush
+  PROBE_OP_PTE_RESTORE = 7,    // restore the PTE of `addr`, no flush
+  PROBE_OP_BARRIER = 8,        // full memory barrier
+};
+
+struct probe_op {
+  u32 kind;
+  s32 status;
+  usize addr;
+  u64 result;
+};
+
+#define PROBE_RING_OPS 1024
+#define PROBE_RING_SZ (PROBE_RING_OPS * sizeof(struct probe_op))
+
+// In-kernel timing loop. PROBE_MEASURE takes `mode`, `iterations` and
+// `bucket_width` from user space, times `iterations` loads of the probe target
+// and fills in the latency histogram and its summary. IRQs are disabled only
+// for PROBE_MEASURE_CHUNK samples at a time.
+enum probe_measure_mode {
+  PROBE_MEASURE_FLUSH_RELOAD = 0, // clflush before every timed load
+  PROBE_MEASURE_RELOAD = 1,       // timed loads of an already cached target
+};
+
+#define PROBE_HIST_BUCKETS 512
+#define PROBE_MEASURE_CHUNK 1024
+
+struct probe_measure {
+  u32 mode;
+  u32 bucket_width; // cycles per bucket, 0 is treated as 1
+  u64 iterations;
+
+  u64 min;
+  u64 median; // lower bound of the median bucket
+  u64 max;
+  u64 overflow; // samples past the last bucket
+  u64 hist[PROBE_HIST_BUCKETS];
+};
+
+static inline void probe_measure_reset(struct probe_measure *m) {
+  if (m->bucket_width == 0)
+    m->bucket_width = 1;
+
+  m->min = (u64)-1;
+  m->median = 0;
+  m->max = 0;
+  m->overflow = 0;
+  for (usize i = 0; i < PROBE_HIST_BUCKETS; i++)
+    m->hist[i] = 0;
+}
+
+static inline void probe_measure_add(struct probe_measure *m, u64 sample) {
+  u64 bucket = sample / m->bucket_width;
+
+  if (sample < m->min)
+    m->min = sample;
+  if (sample > m->max)
+    m->max = sample;
+
+  if (bucket < PROBE_HIST_BUCKETS)
+    m->hist[bucket]++;
+  else
+    m->overflow++;
+}
+
+static inline void probe_measure_finish(struct probe_measure *m) {
+  u64 half = (m->iterations + 1) / 2;
+  u64 seen = 0;
+
+  if (m->iterations == 0) {
+    m->min = 0;
+    return;
+  }
+
+  // If the median falls in the overflow the best we know is the max
+  m->median = m->max;
+  for (usize i = 0; i < PROBE_HIST_BUCKETS; i++) {
+    seen += m->hist[i];
+    if (seen >= half) {
+      m->median = i * m->bucket_width;
+      break;
+    }
+  }
+}
+
 #endif
@@ -12,10 +12,14 @@
 #include <linux/kernel.h>
 #include <linux/ktime.h>
 #include <linux/mm.h>
+#include <linux/mmu_notifier.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/pgtable.h>
+#include <linux/sched/signal.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
+#include <linux/vmalloc.h>
 
 #include "commands.h"
 #include "immintr.h"
@@ -25,24 +29,44 @@ dev_t dev = 0;
 static struct cdev probe_cdev;
 static struct class *dev_class;
 
-static pte_t saved_pte;
-static pte_t *saved_ptep;
+struct probe_pte_slot {
+  unsigned long addr;
+  struct mm_struct *mm;
+  pte_t *ptep;
+  pte_t saved;
+  bool cleared;
+};
 
-volatile usize *ptr = NULL;
+// Everything a test touches is per open file, so tests running on different
+// CPUs never flush, time or restore each other's state. The threads sharing
+// a file are serialised by `lock`, held across every ioctl. mmap runs under
+// mmap_lock, which the ioctls take when a user copy faults, so it does not
+// take it: the ring is only set at open and freed at release.
+//
+// Only the mm that opened the file can clear its PTEs. A notifier on it puts
+// them back when it is torn down: exit_mm() runs before exit_files(), and
+// the teardown would read a cleared PTE as a swap entry.
+struct probe_file {
+  struct mutex lock;
+
+  struct page *target_pages;
+  volatile usize *ptr;
+  struct probe_op *ring;
+
+  struct mm_struct *mm;
+  struct mmu_notifier mn;
+  bool mn_registered;
+
+  struct probe_pte_slot ptes[PROBE_PTE_SLOTS];
+  usize pte_count;
+};
 
-static pte_t *walk_to_pte(unsigned long addr) {
-  unsigned long cr3_val;
-  pgd_t *pgdp;
+
+static pte_t *walk_pgd_to_pte(pgd_t *pgdp, unsigned long addr) {
   p4d_t *p4dp;
   pud_t *pudp;
   pmd_t *pmdp;
 
-  asm volatile("mov %%cr3, %0" : "=r"(cr3_val));
-
-  /* Bits [11:0] of CR3 are the PCID when CR4.PCIDE=1, or reserved
-   * zeroes otherwise.  PAGE_MASK strips them correctly in both cases. */
-  pgdp = (pgd_t *)__va(cr3_val & PAGE_MASK) + pgd_index(addr);
-
   if (pgd_none(*pgdp) || pgd_bad(*pgdp))
     return NULL;
   p4dp = p4d_offset(pgdp, addr);
@@ -66,58 +90,509 @@ static pte_t *walk_to_pte(unsigned long addr) {
   return pte_offset_kernel(pmdp, addr);
 }
 
-void pte_clear_noflush(volatile char *page) {
+static pte_t *walk_to_pte(unsigned long addr) {
+  unsigned long cr3_val;
+
+  asm volatile("mov %%cr3, %0" : "=r"(cr3_val));
+
+  /* Bits [11:0] of CR3 are the PCID when CR4.PCIDE=1, or reserved
+   * zeroes otherwise.  PAGE_MASK strips them correctly in both cases. */
+  return walk_pgd_to_pte((pgd_t *)__va(cr3_val & PAGE_MASK) + pgd_index(addr),
+                         addr);
+}
+
+// For an mm that may not be the one loaded in CR3
+static pte_t *walk_mm_to_pte(struct mm_struct *mm, unsigned long addr) {
+  return walk_pgd_to_pte(pgd_offset(mm, addr), addr);
+}
+
+static struct probe_pte_slot *probe_pte_slot(struct probe_file *pf,
+                                             unsigned long addr) {
+  struct probe_pte_slot *idle = NULL;
+
+  for (usize i = 0; i < pf->pte_count; i++) {
+    struct probe_pte_slot *slot = &pf->ptes[i];
+    if (slot->addr == addr && slot->mm == current->mm)
+      return slot;
+    if (!idle && !slot->cleared)
+      idle = slot;
+  }
+
+  if (pf->pte_count < PROBE_PTE_SLOTS)
+    idle = &pf->ptes[pf->pte_count++];
+
+  // Table full of cleared pages, they have to be restored first
+  if (!idle)
+    return NULL;
+
+  idle->addr = addr;
+  idle->mm = current->mm;
+  idle->ptep = NULL;
+  idle->cleared = false;
+  return idle;
+}
+
+// Clear the present bit of `page`, the caller issues the fence
+static int probe_pte_clear(struct probe_file *pf, volatile char *page) {
   unsigned long addr = (unsigned long)page & PAGE_MASK;
-  pte_t *ptep = walk_to_pte(addr);
+  struct probe_pte_slot *slot;
+  pte_t *ptep;
+
+  if (current->mm != pf->mm) {
+    pr_err("pte_clear_noflush: %lx is not in the mm of the opener\n", addr);
+    return -EPERM;
+  }
+
+  slot = probe_pte_slot(pf, addr);
+  if (!slot) {
+    pr_err("pte_clear_noflush: no free PTE slot for %lx\n", addr);
+    return -ENOSPC;
+  }
+  if (slot->cleared) {
+    pr_err("pte_clear_noflush: PTE already cleared for %lx\n", addr);
+    return -EINVAL;
+  }
+
+  // The cached pointer is only trusted while it still maps the same frame,
+  // otherwise the mapping may have changed under us and we walk again
+  ptep = slot->ptep;
+  if (!ptep || !(pte_val(*ptep) & _PAGE_PRESENT) ||
+      pte_pfn(*ptep) != pte_pfn(slot->saved))
+    ptep = walk_to_pte(addr);
 
   if (!ptep) {
     pr_err("pte_clear_noflush: page-table walk failed for %lx\n", addr);
-    return;
+    slot->ptep = NULL;
+    return -EINVAL;
   }
   if (!(pte_val(*ptep) & _PAGE_PRESENT)) {
     pr_err("pte_clear_noflush: PTE already not-present for %lx\n", addr);
-    return;
+    slot->ptep = NULL;
+    return -EINVAL;
   }
 
-  saved_pte = *ptep;
-  saved_ptep = ptep;
+  slot->saved = *ptep;
+  slot->ptep = ptep;
+  slot->cleared = true;
 
   /* native_set_pte() on x86-64 is WRITE_ONCE(*ptep, pte): a plain
    * 8-byte aligned store.  It does not imply INVLPG or MFENCE.       */
-  native_set_pte(ptep, __pte(pte_val(saved_pte) & ~(pteval_t)_PAGE_PRESENT));
+  native_set_pte(ptep, __pte(pte_val(slot->saved) & ~(pteval_t)_PAGE_PRESENT));
 
   /* Flush the modified PTE cache line to memory.
    * Only the leaf PTE needs flushing — intermediate entries are
    * unchanged and flushing them would evict shared page-table pages
    * from cache for no benefit.                                         */
   asm volatile("clflush (%0)" ::"r"(ptep) : "memory");
-  asm volatile("mfence" ::: "memory");
+
+  return 0;
 }
 
-void pte_restore_noflush(volatile char *page) {
-  if (!saved_ptep) {
-    pr_err("pte_restore_noflush: no saved PTE\n");
-    return;
+// Puts the saved PTE back at `ptep`, found by a fresh walk. The cached slot
+// pointer is not used: the page table may have been freed or the range
+// remapped since the clear, only our own not-present entry is overwritten.
+static int probe_slot_restore(struct probe_pte_slot *slot, pte_t *ptep) {
+  const pteval_t cleared = pte_val(slot->saved) & ~(pteval_t)_PAGE_PRESENT;
+
+  slot->cleared = false;
+  slot->ptep = ptep;
+
+  if (!ptep || pte_val(*ptep) != cleared) {
+    pr_err("pte_restore_noflush: PTE for %lx changed since it was cleared\n",
+           slot->addr);
+    slot->ptep = NULL;
+    return -EINVAL;
   }
 
-  native_set_pte(saved_ptep, saved_pte);
+  native_set_pte(ptep, slot->saved);
 
   /* Flush so that the subsequent tlb_flush_page() — which also CLFLUSHes
    * this address — reads the restored value from memory rather than a
    * stale cached copy of the not-present PTE.                          */
-  asm volatile("clflush (%0)" ::"r"(saved_ptep) : "memory");
+  asm volatile("clflush (%0)" ::"r"(ptep) : "memory");
+
+  return 0;
+}
+
+// Restore the saved PTE of `page`, the caller issues the fence
+static int probe_pte_restore(struct probe_file *pf, volatile char *page) {
+  unsigned long addr = (unsigned long)page & PAGE_MASK;
+  struct probe_pte_slot *slot = NULL;
+
+  for (usize i = 0; i < pf->pte_count; i++) {
+    if (pf->ptes[i].addr == addr && pf->ptes[i].mm == current->mm) {
+      slot = &pf->ptes[i];
+      break;
+    }
+  }
+
+  if (!slot || !slot->cleared) {
+    pr_err("pte_restore_noflush: no saved PTE for %lx\n", addr);
+    return -EINVAL;
+  }
+
+  return probe_slot_restore(slot, walk_to_pte(addr));
+}
+
+// The owner's mm is going away, or the file is closed while it is alive
+static void probe_mm_release(struct mmu_notifier *mn, struct mm_struct *mm) {
+  struct probe_file *pf = container_of(mn, struct probe_file, mn);
+
+  mutex_lock(&pf->lock);
+  for (usize i = 0; i < pf->pte_count; i++) {
+    struct probe_pte_slot *slot = &pf->ptes[i];
+    if (slot->cleared && slot->mm == mm)
+      probe_slot_restore(slot, walk_mm_to_pte(mm, slot->addr));
+  }
+  mutex_unlock(&pf->lock);
+}
+
+static const struct mmu_notifier_ops probe_mn_ops = {
+    .release = probe_mm_release,
+};
+
+static long probe_pte_batch(struct probe_file *pf,
+                            struct probe_pte_batch __user *arg, bool clear) {
+  struct probe_pte_batch batch;
+  usize *addrs;
+  s32 *status;
+  long ret = 0;
+
+  if (copy_from_user(&batch, arg, sizeof(batch)))
+    return -EFAULT;
+
+  if (batch.count == 0 || batch.count > PROBE_PTE_SLOTS)
+    return -EINVAL;
+
+  addrs = kmalloc_array(batch.count, sizeof(*addrs), GFP_KERNEL);
+  status = kmalloc_array(batch.count, sizeof(*status), GFP_KERNEL);
+  if (!addrs || !status) {
+    ret = -ENOMEM;
+    goto free_arrays;
+  }
+
+  if (copy_from_user(addrs, (void __user *)batch.addrs,
+                     batch.count * sizeof(*addrs))) {
+    ret = -EFAULT;
+    goto free_arrays;
+  }
+
+  preempt_disable();
+  for (usize i = 0; i < batch.count; i++) {
+    volatile char *page = (volatile char *)addrs[i];
+    status[i] = clear ? probe_pte_clear(pf, page) : probe_pte_restore(pf, page);
+    if (status[i] && !ret)
+      ret = status[i];
+  }
   asm volatile("mfence" ::: "memory");
+  preempt_enable();
 
-  saved_ptep = NULL;
+  if (batch.status && copy_to_user((void __user *)batch.status, status,
+                                   batch.count * sizeof(*status)))
+    ret = -EFAULT;
+
+free_arrays:
+  kfree(addrs);
+  kfree(status);
+  return ret;
 }
 
-static int probe_open(struct inode *inode, struct file *file) { return 0; }
-static int probe_release(struct inode *inode, struct file *file) { return 0; }
-static long probe_ioctl(struct file *filp, unsigned int cmd,
-                        unsigned long arg) {
+static u64 probe_time_load(struct probe_file *pf) {
+  u64 start, end;
+
+  start = __builtin_ia32_rdtsc();
+  load(pf->ptr);
+
+  rmb();
+  end = __builtin_ia32_rdtsc();
+
+  return end - start;
+}
+
+static void probe_cache(struct probe_file *pf) {
+  load(pf->ptr);
+  load(pf->ptr);
+  load(pf->ptr);
+  load(pf->ptr);
+  load(pf->ptr);
+  load(pf->ptr);
+}
+
+static int probe_tlb_flush_page(unsigned long addr) {
+  unsigned long cr3_val;
+
+  pgd_t *pgdp;
+  p4d_t *p4dp;
+  pud_t *pudp;
+  pmd_t *pmdp;
+  pte_t *ptep;
+
+  asm volatile("mov %%cr3, %0" : "=r"(cr3_val));
+
+  pgdp = (pgd_t *)__va(cr3_val & PAGE_MASK) + pgd_index(addr);
+  if (pgd_none(*pgdp) || pgd_bad(*pgdp))
+    return -EINVAL;
+
+  p4dp = p4d_offset(pgdp, addr);
+  if (p4d_none(*p4dp) || p4d_bad(*p4dp))
+    return -EINVAL;
+
+  pudp = pud_offset(p4dp, addr);
+  if (pud_none(*pudp) || pud_bad(*pudp))
+    return -EINVAL;
+
+  pmdp = pmd_offset(pudp, addr);
+  if (pmd_none(*pmdp) || pmd_bad(*pmdp))
+    return -EINVAL;
+
+  ptep = pte_offset_kernel(pmdp, addr);
+  if (pte_none(*ptep))
+    return -EINVAL;
+
+  asm volatile("clflush (%0)" ::"r"(pgdp) : "memory");
+  asm volatile("clflush (%0)" ::"r"(p4dp) : "memory");
+  asm volatile("clflush (%0)" ::"r"(pudp) : "memory");
+  asm volatile("clflush (%0)" ::"r"(pmdp) : "memory");
+  asm volatile("clflush (%0)" ::"r"(ptep) : "memory");
+  asm volatile("mfence" ::: "memory");
+
+  asm volatile("invlpg (%0)" ::"r"(addr) : "memory");
+  asm volatile("mfence" ::: "memory");
+
+  return 0;
+}
+
+static long probe_ring_run(struct probe_file *pf, usize count) {
+  if (count > PROBE_RING_OPS)
+    return -EINVAL;
+
+  preempt_disable();
+  for (usize i = 0; i < count; i++) {
+    struct probe_op *op = &pf->ring[i];
+    usize addr = READ_ONCE(op->addr);
+
+    op->status = 0;
+    op->result = 0;
+
+    switch ((enum probe_op_kind)READ_ONCE(op->kind)) {
+    case PROBE_OP_NOP:
+      break;
+    case PROBE_OP_FLUSH:
+      cache_line_flush(pf->ptr);
+      break;
+    case PROBE_OP_CACHE:
+      probe_cache(pf);
+      break;
+    case PROBE_OP_TIME_LOAD:
+      op->result = probe_time_load(pf);
+      break;
+    case PROBE_OP_TLB_FLUSH:
+      __flush_tlb_all();
+      break;
+    case PROBE_OP_TLB_FLUSH_PAGE:
+      op->status = probe_tlb_flush_page(addr);
+      break;
+    case PROBE_OP_PTE_CLEAR:
+      op->status = probe_pte_clear(pf, (volatile char *)addr);
+      memory_barrier();
+      break;
+    case PROBE_OP_PTE_RESTORE:
+      op->status = probe_pte_restore(pf, (volatile char *)addr);
+      memory_barrier();
+      break;
+    case PROBE_OP_BARRIER:
+      memory_barrier();
+      break;
+    default:
+      op->status = -EINVAL;
+      break;
+    }
+  }
+  preempt_enable();
+
+  return 0;
+}
+
+static long probe_measure(struct probe_file *pf,
+                          struct probe_measure __user *arg) {
+  struct probe_measure *m;
+  unsigned long flags;
+  long ret = 0;
+
+  m = kmalloc(sizeof(*m), GFP_KERNEL);
+  if (m == NULL)
+    return -ENOMEM;
+
+  if (copy_from_user(m, arg, sizeof(*m))) {
+    ret = -EFAULT;
+    goto free_m;
+  }
+
+  if (m->mode != PROBE_MEASURE_FLUSH_RELOAD && m->mode != PROBE_MEASURE_RELOAD) {
+    ret = -EINVAL;
+    goto free_m;
+  }
+
+  probe_measure_reset(m);
+
+  for (u64 done = 0; done < m->iterations;) {
+    u64 chunk = min_t(u64, m->iterations - done, PROBE_MEASURE_CHUNK);
+
+    local_irq_save(flags);
+    if (m->mode == PROBE_MEASURE_RELOAD)
+      probe_cache(pf);
+
+    for (u64 i = 0; i < chunk; i++) {
+      if (m->mode == PROBE_MEASURE_FLUSH_RELOAD)
+        cache_line_flush(pf->ptr);
+      memory_barrier();
+
+      probe_measure_add(m, probe_time_load(pf));
+    }
+    local_irq_restore(flags);
+
+    done += chunk;
+
+    // Give the scheduler a chance between chunks, long runs stay killable.
+    // The other users of the file get it too, the target is read again.
+    mutex_unlock(&pf->lock);
+    cond_resched();
+    mutex_lock(&pf->lock);
+    if (fatal_signal_pending(current)) {
+      ret = -EINTR;
+      goto free_m;
+    }
+  }
+
+  probe_measure_finish(m);
+
+  if (copy_to_user(arg, m, sizeof(*m)))
+    ret = -EFAULT;
+
+free_m:
+  kfree(m);
+  return ret;
+}
+
+static int probe_target_alloc(struct probe_file *pf, int cpu) {
+  struct page *pages;
+
+  pages = alloc_pages_node(cpu_to_node(cpu), GFP_KERNEL | __GFP_ZERO,
+                           get_order(PROBE_TARGET_SZ));
+  if (pages == NULL)
+    return -ENOMEM;
 
+  if (pf->target_pages)
+    __free_pages(pf->target_pages, get_order(PROBE_TARGET_SZ));
+
+  pf->target_pages = pages;
+  pf->ptr = page_address(pages);
+  return 0;
+}
+
+static long probe_set_target(struct probe_file *pf,
+                             struct probe_target __user *arg) {
+  struct probe_target target;
+  int ret;
+
+  if (copy_from_user(&target, arg, sizeof(target)))
+    return -EFAULT;
+
+  if (target.offset >= PROBE_TARGET_SZ || target.offset % L1_CACHE_BYTES)
+    return -EINVAL;
+
+  if (target.cpu >= 0) {
+    if (target.cpu >= nr_cpu_ids || !cpu_possible(target.cpu))
+      return -EINVAL;
+
+    ret = probe_target_alloc(pf, target.cpu);
+    if (ret)
+      return ret;
+  }
+
+  pf->ptr = (volatile usize *)((u8 *)page_address(pf->target_pages) +
+                               target.offset);
+
+  target.addr = (usize)pf->ptr;
+  if (copy_to_user(arg, &target, sizeof(target)))
+    return -EFAULT;
+
+  return 0;
+}
+
+static int probe_mmap(struct file *filp, struct vm_area_struct *vma) {
+  struct probe_file *pf = filp->private_data;
+
+  if (vma->vm_pgoff != 0 ||
+      vma->vm_end - vma->vm_start > PAGE_ALIGN(PROBE_RING_SZ))
+    return -EINVAL;
+
+  return remap_vmalloc_range(vma, pf->ring, 0);
+}
+
+static int probe_open(struct inode *inode, struct file *file) {
+  struct probe_file *pf;
+  int ret;
+
+  pf = kvzalloc(sizeof(*pf), GFP_KERNEL);
+  if (pf == NULL)
+    return -ENOMEM;
+
+  mutex_init(&pf->lock);
+
+  ret = probe_target_alloc(pf, raw_smp_processor_id());
+  if (ret)
+    goto free_pf;
+
+  pf->ring = vmalloc_user(PAGE_ALIGN(PROBE_RING_SZ));
+  if (pf->ring == NULL) {
+    ret = -ENOMEM;
+    goto free_target;
+  }
+
+  pf->mm = current->mm;
+  if (pf->mm) {
+    pf->mn.ops = &probe_mn_ops;
+    ret = mmu_notifier_register(&pf->mn, pf->mm);
+    if (ret)
+      goto free_ring;
+    pf->mn_registered = true;
+  }
+
+  file->private_data = pf;
+  return 0;
+
+free_ring:
+  vfree(pf->ring);
+
+free_target:
+  __free_pages(pf->target_pages, get_order(PROBE_TARGET_SZ));
+
+free_pf:
+  kvfree(pf);
+  return ret;
+}
+
+static int probe_release(struct inode *inode, struct file *file) {
+  struct probe_file *pf = file->private_data;
+
+  // Runs probe_mm_release() unless the teardown of the mm already did
+  if (pf->mn_registered)
+    mmu_notifier_unregister(&pf->mn, pf->mm);
+
+  vfree(pf->ring);
+  __free_pages(pf->target_pages, get_order(PROBE_TARGET_SZ));
+  mutex_destroy(&pf->lock);
+  kvfree(pf);
+  return 0;
+}
+
+// Called with pf->lock held
+static long probe_ioctl_locked(struct probe_file *pf, unsigned int cmd,
+                               unsigned long arg) {
   struct probe_request request;
   unsigned long addr;
+  int ret;
 
   switch ((enum probe_command)cmd) {
   case PROBE_GET:
@@ -129,19 +604,9 @@ static long probe_ioctl(struct file *filp, unsigned int cmd,
     }
 
     // Measure access time
-    ktime_t start, end;
-    usize value;
-
-    start = __builtin_ia32_rdtsc();
-    load(ptr);
-
-    rmb();
-    end = __builtin_ia32_rdtsc();
-
-    // Calculate elapsed time in nanoseconds
-    u64 elapsed_ns = end - start;
+    u64 elapsed_ns = probe_time_load(pf);
 
-    if (copy_to_user(request.ret, &ptr, sizeof(usize))) {
+    if (copy_to_user(request.ret, &pf->ptr, sizeof(usize))) {
       printk("Failed to copy result to the user");
       return -EFAULT;
     }
@@ -153,17 +618,12 @@ static long probe_ioctl(struct file *filp, unsigned int cmd,
 
     break;
   case PROBE_CACHE:
-    load(ptr);
-    load(ptr);
-    load(ptr);
-    load(ptr);
-    load(ptr);
-    load(ptr);
+    probe_cache(pf);
 
     break;
   case PROBE_UNCACHE:
     preempt_disable();
-    cache_line_flush(ptr);
+    cache_line_flush(pf->ptr);
     preempt_enable();
 
     break;
@@ -182,48 +642,7 @@ static long probe_ioctl(struct file *filp, unsigned int cmd,
       return -EINVAL;
     }
 
-    addr = (unsigned long)request.ret;
-    unsigned long cr3_val;
-
-    pgd_t *pgdp;
-    p4d_t *p4dp;
-    pud_t *pudp;
-    pmd_t *pmdp;
-    pte_t *ptep;
-
-    asm volatile("mov %%cr3, %0" : "=r"(cr3_val));
-
-    pgdp = (pgd_t *)__va(cr3_val & PAGE_MASK) + pgd_index(addr);
-    if (pgd_none(*pgdp) || pgd_bad(*pgdp))
-      return -EINVAL;
-
-    p4dp = p4d_offset(pgdp, addr);
-    if (p4d_none(*p4dp) || p4d_bad(*p4dp))
-      return -EINVAL;
-
-    pudp = pud_offset(p4dp, addr);
-    if (pud_none(*pudp) || pud_bad(*pudp))
-      return -EINVAL;
-
-    pmdp = pmd_offset(pudp, addr);
-    if (pmd_none(*pmdp) || pmd_bad(*pmdp))
-      return -EINVAL;
-
-    ptep = pte_offset_kernel(pmdp, addr);
-    if (pte_none(*ptep))
-      return -EINVAL;
-
-    asm volatile("clflush (%0)" ::"r"(pgdp) : "memory");
-    asm volatile("clflush (%0)" ::"r"(p4dp) : "memory");
-    asm volatile("clflush (%0)" ::"r"(pudp) : "memory");
-    asm volatile("clflush (%0)" ::"r"(pmdp) : "memory");
-    asm volatile("clflush (%0)" ::"r"(ptep) : "memory");
-    asm volatile("mfence" ::: "memory");
-
-    asm volatile("invlpg (%0)" ::"r"(request.ret) : "memory");
-    asm volatile("mfence" ::: "memory");
-
-    break;
+    return probe_tlb_flush_page((unsigned long)request.ret);
 
   case PROBE_TLB_REMOVE_PTE:
     if (copy_from_user((void *)&request, (void __user *)arg,
@@ -235,9 +654,10 @@ static long probe_ioctl(struct file *filp, unsigned int cmd,
 
     addr = (unsigned long)request.ret;
     preempt_disable();
-    pte_clear_noflush((volatile char *)addr);
+    ret = probe_pte_clear(pf, (volatile char *)addr);
+    asm volatile("mfence" ::: "memory");
     preempt_enable();
-    break;
+    return ret;
   case PROBE_TLB_RESTORE_PTE:
     if (copy_from_user((void *)&request, (void __user *)arg,
                        sizeof(struct probe_request))) {
@@ -248,9 +668,25 @@ static long probe_ioctl(struct file *filp, unsigned int cmd,
 
     addr = (unsigned long)request.ret;
     preempt_disable();
-    pte_restore_noflush((volatile char *)addr);
+    ret = probe_pte_restore(pf, (volatile char *)addr);
+    asm volatile("mfence" ::: "memory");
     preempt_enable();
-    break;
+    return ret;
+
+  case PROBE_RING_SUBMIT:
+    return probe_ring_run(pf, (usize)arg);
+
+  case PROBE_MEASURE:
+    return probe_measure(pf, (struct probe_measure __user *)arg);
+
+  case PROBE_SET_TARGET:
+    return probe_set_target(pf, (struct probe_target __user *)arg);
+
+  case PROBE_PTE_CLEAR_BATCH:
+    return probe_pte_batch(pf, (struct probe_pte_batch __user *)arg, true);
+
+  case PROBE_PTE_RESTORE_BATCH:
+    return probe_pte_batch(pf, (struct probe_pte_batch __user *)arg, false);
 
   default:
     return -EINVAL;
@@ -258,6 +694,19 @@ static long probe_ioctl(struct file *filp, unsigned int cmd,
   return 0;
 }
 
+static long probe_ioctl(struct file *filp, unsigned int cmd,
+                        unsigned long arg) {
+  struct probe_file *pf = filp->private_data;
+  long ret;
+
+  if (mutex_lock_interruptible(&pf->lock))
+    return -ERESTARTSYS;
+
+  ret = probe_ioctl_locked(pf, cmd, arg);
+  mutex_unlock(&pf->lock);
+  return ret;
+}
+
 static struct file_operations fops = {
     .owner = THIS_MODULE,
     .read = NULL,
@@ -265,6 +714,7 @@ static struct file_operations fops = {
     .open = probe_open,
     .release = probe_release,
     .unlocked_ioctl = probe_ioctl,
+    .mmap = probe_mmap,
 };
 
 static int __init probe_init(void) {
@@ -300,13 +750,6 @@ static int __init probe_init(void) {
     goto destroy_class;
   }
 
-  ptr = kmalloc(sizeof(usize), GFP_KERNEL);
-  if (ptr == NULL) {
-    printk("failed to malloc");
-    ret = -ENOMEM;
-    goto destroy_class;
-  }
-
   pr_info("Kernel Module Inserted Successfully\n");
   return 0;
 
@@ -326,7 +769,6 @@ static void __exit probe_exit(void) {
   class_destroy(dev_class);
   cdev_del(&probe_cdev);
   unregister_chrdev_region(dev, 1);
-  kfree((void *)ptr);
   pr_info("Kernel Module Removed Successfully\n");
 }
 